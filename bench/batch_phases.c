@@ -0,0 +1,87 @@
+/* Cost per phase of a persistent pool versus an init/destroy cycle
+ 
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "yatpool.h"
+
+#define NUM_THREADS 8
+#define NUM_PHASES 200
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+void* empty_task(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+void submit_phase(YATPool* pool, size_t num_tasks) {
+    for (size_t i=0; i<num_tasks; ++i) {
+        Task* task;
+        task_init(&task, &empty_task, NULL, NULL);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+}
+
+/// Every phase creates and joins its own worker threads
+double init_destroy_per_phase(size_t num_tasks) {
+    double start = now_ns();
+    for (int i=0; i<NUM_PHASES; ++i) {
+        YATPool* pool;
+        yatpool_init(&pool, NUM_THREADS, num_tasks);
+        submit_phase(pool, num_tasks);
+        yatpool_destroy(pool);
+    }
+    return (now_ns() - start) / NUM_PHASES;
+}
+
+/// All phases run as batches on the same worker threads
+double reset_per_phase(size_t num_tasks) {
+    double start = now_ns();
+    YATPool* pool;
+    yatpool_init(&pool, NUM_THREADS, num_tasks);
+    for (int i=0; i<NUM_PHASES; ++i) {
+        if (i > 0)
+            yatpool_reset(pool, num_tasks);
+        submit_phase(pool, num_tasks);
+    }
+    yatpool_destroy(pool);
+    return (now_ns() - start) / NUM_PHASES;
+}
+
+int main(void) {
+    printf("%10s %22s %22s\n", "tasks", "init/destroy us/phase", "reset us/phase");
+
+    for (size_t num_tasks = 1; num_tasks <= 4096; num_tasks *= 8) {
+        double cycle = init_destroy_per_phase(num_tasks);
+        double batch = reset_per_phase(num_tasks);
+        printf("%10zu %22.1f %22.1f\n", num_tasks, cycle / 1000.0, batch / 1000.0);
+    }
+
+    return EXIT_SUCCESS;
+}
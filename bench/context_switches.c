@@ -0,0 +1,85 @@
+/* Context switches per million tasks with workers parking on a condition
+   variable and on a futex
+ 
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "yatpool.h"
+
+#define NUM_THREADS 8
+#define NUM_TASKS 1000000
+#define BURST_SIZE 16
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/// Get the number of voluntary and involuntary context switches of all
+/// threads of the process so far
+long context_switches(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+void* empty_task(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+/// Submit NUM_TASKS empty tasks in bursts, letting the workers go idle
+/// between bursts, and print the context switches per million tasks
+void measure(const char* name, YATPoolParking parking) {
+    YATPoolOptions options;
+    yatpool_options_init(&options, NUM_THREADS, 0);
+    options.parking = parking;
+
+    YATPool* pool;
+    yatpool_init_with_options(&pool, &options);
+
+    long switches = context_switches();
+    double start = now_ns();
+    for (size_t i=0; i<NUM_TASKS; i+=BURST_SIZE) {
+        for (size_t j=0; j<BURST_SIZE; ++j) {
+            Task* task;
+            yatpool_task_init(pool, &task, &empty_task, NULL, NULL);
+            yatpool_put(pool, task);
+        }
+        yatpool_quiesce(pool);
+    }
+    double end = now_ns();
+    switches = context_switches() - switches;
+    yatpool_destroy(pool);
+
+    printf("%10s %24.0f %12.1f\n", name, (double)switches * 1e6 / NUM_TASKS, (end - start) / 1e6);
+}
+
+int main(void) {
+    printf("%10s %24s %12s\n", "parking", "switches per 1M tasks", "ms");
+    measure("condvar", YATPOOL_PARK_CONDVAR);
+    measure("futex", YATPOOL_PARK_FUTEX);
+    return 0;
+}
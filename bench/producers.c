@@ -0,0 +1,101 @@
+/* Submission throughput of the locked and lock-free task queues
+ 
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "yatpool.h"
+
+#define NUM_THREADS 4
+#define NUM_TASKS (1 << 18)
+#define QUEUE_SIZE 1024
+
+typedef struct {
+    YATPool* pool;
+    size_t num_tasks;
+} ProducerArg;
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+void* empty_task(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+void* produce(void* arg) {
+    ProducerArg* _arg = (ProducerArg*)arg;
+    for (size_t i=0; i<_arg->num_tasks; ++i) {
+        Task* task;
+        task_init(&task, &empty_task, NULL, NULL);
+        yatpool_put(_arg->pool, task);
+    }
+    return NULL;
+}
+
+/// Submit NUM_TASKS empty tasks from the given number of producer threads
+/// and return the number of tasks completed per second.
+double tasks_per_second(YATPoolQueueType queue_type, size_t num_producers) {
+    size_t per_producer = NUM_TASKS / num_producers;
+
+    YATPoolOptions options;
+    yatpool_options_init(&options, NUM_THREADS, per_producer * num_producers);
+    options.queue_size = QUEUE_SIZE;
+    options.queue_type = queue_type;
+
+    YATPool* pool;
+    yatpool_init_with_options(&pool, &options);
+
+    pthread_t* producers = (pthread_t*)calloc(num_producers, sizeof(pthread_t));
+    ProducerArg arg = {pool, per_producer};
+
+    double start = now_ns();
+    for (size_t i=0; i<num_producers; ++i)
+        pthread_create(&producers[i], NULL, &produce, &arg);
+    for (size_t i=0; i<num_producers; ++i)
+        pthread_join(producers[i], NULL);
+    yatpool_wait(pool);
+    double end = now_ns();
+
+    yatpool_destroy(pool);
+    free(producers);
+
+    return (double)(per_producer * num_producers) / ((end - start) / 1e9);
+}
+
+int main(void) {
+    size_t num_producers[] = {1, 4, 16, 64};
+
+    printf("%10s %16s %16s %10s\n", "producers", "locked ops/s", "lock-free ops/s", "speedup");
+
+    for (size_t i=0; i<sizeof(num_producers)/sizeof(num_producers[0]); ++i) {
+        double locked = tasks_per_second(YATPOOL_QUEUE_LOCKED, num_producers[i]);
+        double lock_free = tasks_per_second(YATPOOL_QUEUE_LOCK_FREE, num_producers[i]);
+        printf("%10zu %16.0f %16.0f %9.2fx\n", num_producers[i], locked, lock_free, lock_free / locked);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/* Submission time of a fan-out phase with yatpool_put and yatpool_put_batch
+ 
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "yatpool.h"
+
+#define NUM_THREADS 8
+#define NUM_TASKS 16384
+#define NUM_REPEATS 10
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+void* empty_task(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+/// Submit NUM_TASKS empty tasks and measure the time spent submitting and
+/// the time until all of them completed, in microseconds
+void fan_out(YATPool* pool, bool batched, double* submit_us, double* total_us) {
+    Task** tasks = (Task**)malloc(NUM_TASKS * sizeof(Task*));
+    for (size_t i=0; i<NUM_TASKS; ++i)
+        yatpool_task_init(pool, &tasks[i], &empty_task, NULL, NULL);
+
+    double start = now_ns();
+    if (batched) {
+        yatpool_put_batch(pool, tasks, NUM_TASKS);
+    } else {
+        for (size_t i=0; i<NUM_TASKS; ++i)
+            yatpool_put(pool, tasks[i]);
+    }
+    double submitted = now_ns();
+    yatpool_wait(pool);
+    double end = now_ns();
+
+    *submit_us = (submitted - start) / 1000.0;
+    *total_us = (end - start) / 1000.0;
+    free(tasks);
+}
+
+int main(void) {
+    YATPoolOptions options;
+    yatpool_options_init(&options, NUM_THREADS, NUM_TASKS);
+    options.queue_size = NUM_TASKS;
+
+    printf("%14s %14s %14s\n", "mode", "submit us", "total us");
+
+    for (int batched = 0; batched < 2; ++batched) {
+        YATPool* pool;
+        yatpool_init_with_options(&pool, &options);
+
+        double best_submit = 0.0, best_total = 0.0;
+        for (int i=0; i<NUM_REPEATS; ++i) {
+            double submit_us, total_us;
+            if (i > 0)
+                yatpool_reset(pool, NUM_TASKS);
+            fan_out(pool, batched, &submit_us, &total_us);
+            if (i == 0 || submit_us < best_submit)
+                best_submit = submit_us;
+            if (i == 0 || total_us < best_total)
+                best_total = total_us;
+        }
+        yatpool_destroy(pool);
+
+        printf("%14s %14.1f %14.1f\n", batched? "put_batch": "put", best_submit, best_total);
+    }
+
+    return EXIT_SUCCESS;
+}
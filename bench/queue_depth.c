@@ -0,0 +1,115 @@
+/* Dequeue cost of the task queue as a function of queue depth
+ 
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "yatpool.h"
+
+#define MIN_DEPTH 1024
+#define MAX_DEPTH (1024 * 1024)
+#define NUM_REPEATS 5
+
+/// Gate that keeps the single worker busy while the queue is being filled
+typedef struct {
+    bool open;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} Gate;
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+void* wait_for_gate(void* arg) {
+    Gate* gate = (Gate*)arg;
+    pthread_mutex_lock(&gate->mutex);
+    while (!gate->open)
+        pthread_cond_wait(&gate->cond, &gate->mutex);
+    pthread_mutex_unlock(&gate->mutex);
+    return NULL;
+}
+
+void* empty_task(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+/// Fill the queue to the given depth behind a blocked worker, then time
+/// how long the worker takes to drain it. Returns nanoseconds per task.
+double drain_time_per_task(size_t depth) {
+    Gate gate;
+    gate.open = false;
+    pthread_mutex_init(&gate.mutex, NULL);
+    pthread_cond_init(&gate.cond, NULL);
+
+    YATPoolOptions options;
+    yatpool_options_init(&options, 1, depth + 1);
+    options.queue_size = depth + 1;
+
+    YATPool* pool;
+    yatpool_init_with_options(&pool, &options);
+
+    Task* task;
+    task_init(&task, &wait_for_gate, &gate, NULL);
+    yatpool_put(pool, task);
+
+    for (size_t i=0; i<depth; ++i) {
+        task_init(&task, &empty_task, NULL, NULL);
+        yatpool_put(pool, task);
+    }
+
+    double start = now_ns();
+    pthread_mutex_lock(&gate.mutex);
+    gate.open = true;
+    pthread_cond_signal(&gate.cond);
+    pthread_mutex_unlock(&gate.mutex);
+
+    yatpool_wait(pool);
+    double end = now_ns();
+
+    yatpool_destroy(pool);
+    pthread_cond_destroy(&gate.cond);
+    pthread_mutex_destroy(&gate.mutex);
+
+    return (end - start) / (double)depth;
+}
+
+int main(void) {
+    printf("%12s %16s\n", "depth", "ns per dequeue");
+
+    for (size_t depth = MIN_DEPTH; depth <= MAX_DEPTH; depth *= 4) {
+        double best = 0.0;
+        for (int i=0; i<NUM_REPEATS; ++i) {
+            double t = drain_time_per_task(depth);
+            if (i == 0 || t < best)
+                best = t;
+        }
+        printf("%12zu %16.1f\n", depth, best);
+    }
+
+    return EXIT_SUCCESS;
+}
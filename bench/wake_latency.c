@@ -0,0 +1,86 @@
+/* Latency from submission to the start of a task after an idle period,
+   with idle workers parking straight away and spinning first
+ 
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "yatpool.h"
+
+#define NUM_THREADS 4
+#define NUM_ROUNDS 2000
+#define IDLE_US 50
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/// Record the time the task started at
+void* record_start(void* arg) {
+    *(double*)arg = now_ns();
+    return NULL;
+}
+
+int cmp_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/// Submit one task at a time after letting the workers go idle, and print
+/// the median and 99th percentile latency until it starts
+void measure(const char* name, size_t spin_count, size_t yield_count) {
+    YATPoolOptions options;
+    yatpool_options_init(&options, NUM_THREADS, 0);
+    options.spin_count = spin_count;
+    options.yield_count = yield_count;
+
+    YATPool* pool;
+    yatpool_init_with_options(&pool, &options);
+
+    double* latencies = (double*)malloc(NUM_ROUNDS * sizeof(double));
+    for (size_t i=0; i<NUM_ROUNDS; ++i) {
+        usleep(IDLE_US);
+
+        double started = 0.0;
+        Task* task;
+        yatpool_task_init(pool, &task, &record_start, &started, NULL);
+        double submitted = now_ns();
+        yatpool_put(pool, task);
+        yatpool_quiesce(pool);
+        latencies[i] = (started - submitted) / 1000.0;
+    }
+    yatpool_destroy(pool);
+
+    qsort(latencies, NUM_ROUNDS, sizeof(double), cmp_doubles);
+    printf("%20s %12.2f %12.2f\n", name, latencies[NUM_ROUNDS / 2], latencies[NUM_ROUNDS * 99 / 100]);
+    free(latencies);
+}
+
+int main(void) {
+    printf("%20s %12s %12s\n", "idle policy", "p50 us", "p99 us");
+    measure("park", 0, 0);
+    measure("spin, yield, park", 20000, 100);
+    return 0;
+}
@@ -0,0 +1,573 @@
+/* Benchmark suite tracking the scheduling overhead of yatpool, with JSON output
+
+    YATPool - Yet Another Thread Pool implemented in C
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "yatpool.h"
+
+#define DEFAULT_THREADS 4
+#define QUEUE_SIZE 1024
+#define SUBMIT_TASKS (1 << 18)
+#define SUBMIT_BATCH 256
+#define LATENCY_ROUNDS 10000
+#define BARRIER_ROUNDS 2000
+#define PRODUCER_TASKS (1 << 18)
+#define MONTE_CARLO_ITS (1 << 24)
+#define WRITER_LINES 100000
+#define WRITER_COLS 100     // Numbers in each line written by the writer scenario
+#define WRITER_LINES_PER_CHUNK 512
+#define OVERFLOW_TASKS (1 << 16)
+#define OVERFLOW_QUEUE_SIZE 64
+#define OVERFLOW_SPIN 2000      // Iterations of the tasks of the overflow scenario
+
+/// One measurement of the suite
+typedef struct {
+    const char* scenario;
+    char name[64];
+    double value;
+    const char* unit;
+} Result;
+
+/// Measurements collected so far
+typedef struct {
+    Result* results;
+    size_t num_results, max_results;
+} Report;
+
+/// Settings shared by the scenarios
+typedef struct {
+    size_t num_threads;
+    const char* dir;        // Directory the writer scenario writes its file to
+} BenchConfig;
+
+/// Get the current time in nanoseconds
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/// Add a measurement to the report and echo it on stderr
+void report_add(Report* report, const char* scenario, const char* name, double value, const char* unit) {
+    if (report->num_results == report->max_results) {
+        report->max_results = report->max_results == 0? 32: 2 * report->max_results;
+        report->results = (Result*)realloc(report->results, report->max_results * sizeof(Result));
+    }
+    Result* result = &report->results[report->num_results++];
+    result->scenario = scenario;
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->value = value;
+    result->unit = unit;
+    fprintf(stderr, "%-12s %-32s %16.2f %s\n", scenario, name, value, unit);
+}
+
+/// Write the report as JSON
+void report_write(const Report* report, const BenchConfig* config, FILE* file) {
+    fprintf(file, "{\n  \"suite\": \"yatpool_bench\",\n  \"threads\": %zu,\n", config->num_threads);
+    fprintf(file, "  \"cpus\": %ld,\n  \"results\": [\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (size_t i = 0; i < report->num_results; ++i) {
+        const Result* result = &report->results[i];
+        fprintf(file, "    {\"scenario\": \"%s\", \"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}%s\n",
+                result->scenario, result->name, result->value, result->unit,
+                i + 1 < report->num_results? ",": "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int cmp_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+void* empty_task(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+/// Spin for a while, so that a single producer outruns the workers
+void* spin_task(void* arg) {
+    volatile size_t count = 0;
+    for (size_t i = 0; i < *(size_t*)arg; ++i)
+        count++;
+    return NULL;
+}
+
+void empty_body(size_t begin, size_t end, void* ctx) {
+    (void)begin;
+    (void)end;
+    (void)ctx;
+}
+
+/// Create a streaming pool with room for bursts of tasks
+YATPool* bench_pool(const BenchConfig* config, YATPoolQueueType queue_type) {
+    YATPoolOptions options;
+    yatpool_options_init(&options, config->num_threads, 0);
+    options.queue_size = QUEUE_SIZE;
+    options.queue_type = queue_type;
+
+    YATPool* pool;
+    yatpool_init_with_options(&pool, &options);
+    return pool;
+}
+
+/****************************************************************************/
+/*******************************Scenarios************************************/
+/****************************************************************************/
+
+/// Empty tasks per second, submitted one at a time and in batches
+void bench_submit(const BenchConfig* config, Report* report) {
+    YATPool* pool = bench_pool(config, YATPOOL_QUEUE_LOCKED);
+
+    double start = now_ns();
+    for (size_t i = 0; i < SUBMIT_TASKS; ++i) {
+        Task* task;
+        yatpool_task_init(pool, &task, &empty_task, NULL, NULL);
+        yatpool_put(pool, task);
+    }
+    yatpool_quiesce(pool);
+    report_add(report, "submit", "put", SUBMIT_TASKS / ((now_ns() - start) / 1e9), "tasks/s");
+
+    Task* tasks[SUBMIT_BATCH];
+    start = now_ns();
+    for (size_t i = 0; i < SUBMIT_TASKS; i += SUBMIT_BATCH) {
+        for (size_t j = 0; j < SUBMIT_BATCH; ++j)
+            yatpool_task_init(pool, &tasks[j], &empty_task, NULL, NULL);
+        yatpool_put_batch(pool, tasks, SUBMIT_BATCH);
+    }
+    yatpool_quiesce(pool);
+    report_add(report, "submit", "put_batch", SUBMIT_TASKS / ((now_ns() - start) / 1e9), "tasks/s");
+
+    yatpool_destroy(pool);
+}
+
+/// Round trip of a single task through an otherwise idle pool, from
+/// yatpool_submit until future_get returns
+void bench_latency(const BenchConfig* config, Report* report) {
+    YATPool* pool = bench_pool(config, YATPOOL_QUEUE_LOCKED);
+
+    double* latencies = (double*)malloc(LATENCY_ROUNDS * sizeof(double));
+    for (size_t i = 0; i < LATENCY_ROUNDS; ++i) {
+        Task* task;
+        yatpool_task_init(pool, &task, &empty_task, NULL, NULL);
+        double start = now_ns();
+        Future* future = yatpool_submit(pool, task);
+        future_get(future);
+        latencies[i] = now_ns() - start;
+        future_destroy(future);
+    }
+    yatpool_destroy(pool);
+
+    qsort(latencies, LATENCY_ROUNDS, sizeof(double), cmp_doubles);
+    report_add(report, "latency", "round_trip_p50", latencies[LATENCY_ROUNDS / 2], "ns");
+    report_add(report, "latency", "round_trip_p99", latencies[LATENCY_ROUNDS * 99 / 100], "ns");
+    free(latencies);
+}
+
+/// Cost of fanning work out to every worker and waiting for all of it: an
+/// empty parallel loop, and a batch of one empty task per worker followed
+/// by yatpool_quiesce
+void bench_fanout(const BenchConfig* config, Report* report) {
+    YATPool* pool = bench_pool(config, YATPOOL_QUEUE_LOCKED);
+    YATPoolSchedule schedule = {YATPOOL_SCHEDULE_STATIC, 0};
+
+    double start = now_ns();
+    for (size_t i = 0; i < BARRIER_ROUNDS; ++i)
+        yatpool_parallel_for(pool, 0, config->num_threads + 1, &empty_body, NULL, schedule);
+    report_add(report, "fanout", "parallel_for", (now_ns() - start) / BARRIER_ROUNDS, "ns/barrier");
+
+    Task** tasks = (Task**)malloc(config->num_threads * sizeof(Task*));
+    start = now_ns();
+    for (size_t i = 0; i < BARRIER_ROUNDS; ++i) {
+        for (size_t j = 0; j < config->num_threads; ++j)
+            yatpool_task_init(pool, &tasks[j], &empty_task, NULL, NULL);
+        yatpool_put_batch(pool, tasks, config->num_threads);
+        yatpool_quiesce(pool);
+    }
+    report_add(report, "fanout", "put_batch_quiesce", (now_ns() - start) / BARRIER_ROUNDS, "ns/barrier");
+    free(tasks);
+
+    yatpool_destroy(pool);
+}
+
+typedef struct {
+    YATPool* pool;
+    size_t num_tasks;
+} ProducerArg;
+
+void* produce(void* arg) {
+    ProducerArg* _arg = (ProducerArg*)arg;
+    for (size_t i = 0; i < _arg->num_tasks; ++i) {
+        Task* task;
+        yatpool_task_init(_arg->pool, &task, &empty_task, NULL, NULL);
+        yatpool_put(_arg->pool, task);
+    }
+    return NULL;
+}
+
+/// Empty tasks per second submitted by several producer threads at once,
+/// into the locked and the lock-free queue
+void bench_producers(const BenchConfig* config, Report* report) {
+    size_t num_producers[] = {1, 4, 16};
+    YATPoolQueueType queue_types[] = {YATPOOL_QUEUE_LOCKED, YATPOOL_QUEUE_LOCK_FREE};
+    const char* queue_names[] = {"locked", "lock_free"};
+
+    for (size_t q = 0; q < 2; ++q) {
+        for (size_t i = 0; i < sizeof(num_producers) / sizeof(num_producers[0]); ++i) {
+            YATPool* pool = bench_pool(config, queue_types[q]);
+            pthread_t* producers = (pthread_t*)calloc(num_producers[i], sizeof(pthread_t));
+            ProducerArg arg = {pool, PRODUCER_TASKS / num_producers[i]};
+
+            double start = now_ns();
+            for (size_t p = 0; p < num_producers[i]; ++p)
+                pthread_create(&producers[p], NULL, &produce, &arg);
+            for (size_t p = 0; p < num_producers[i]; ++p)
+                pthread_join(producers[p], NULL);
+            yatpool_quiesce(pool);
+            double seconds = (now_ns() - start) / 1e9;
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s_%zu_producers", queue_names[q], num_producers[i]);
+            report_add(report, "producers", name, arg.num_tasks * num_producers[i] / seconds, "tasks/s");
+            yatpool_destroy(pool);
+            free(producers);
+        }
+    }
+}
+
+/// Count the points under y = 9 - x^2 among points drawn in [0, 3] x [0, 9]
+void count_hits(size_t begin, size_t end, void* partial, void* ctx) {
+    (void)ctx;
+    size_t hits = 0;
+    unsigned int seed = 42 + begin;
+    for (size_t i = begin; i < end; ++i) {
+        double x = 3.0 * (double)rand_r(&seed) / (double)RAND_MAX;
+        double y = 9.0 * (double)rand_r(&seed) / (double)RAND_MAX;
+        if (y <= 9.0 - x * x)
+            hits++;
+    }
+    *(size_t*)partial += hits;
+}
+
+void add_hits(void* accum, const void* value, void* ctx) {
+    (void)ctx;
+    *(size_t*)accum += *(const size_t*)value;
+}
+
+/// Monte Carlo integration as in the numerical integration example, serial
+/// and as a parallel reduction with chunks of several sizes. Small chunks
+/// show how much of the speedup scheduling overhead eats.
+void bench_monte_carlo(const BenchConfig* config, Report* report) {
+    size_t hits = 0;
+    double start = now_ns();
+    count_hits(0, MONTE_CARLO_ITS, &hits, NULL);
+    double serial = now_ns() - start;
+    report_add(report, "monte_carlo", "serial", serial / 1e6, "ms");
+
+    YATPool* pool = bench_pool(config, YATPOOL_QUEUE_LOCKED);
+    size_t chunk_sizes[] = {1 << 10, 1 << 14, 1 << 18};
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i) {
+        YATPoolSchedule schedule = {YATPOOL_SCHEDULE_DYNAMIC, chunk_sizes[i]};
+        size_t zero = 0, total = 0;
+        start = now_ns();
+        yatpool_parallel_reduce(pool, 0, MONTE_CARLO_ITS, &zero, sizeof(size_t),
+                                &count_hits, &add_hits, NULL, schedule, &total);
+        double elapsed = now_ns() - start;
+
+        char name[64];
+        snprintf(name, sizeof(name), "chunk_%zu", chunk_sizes[i]);
+        report_add(report, "monte_carlo", name, elapsed / 1e6, "ms");
+        snprintf(name, sizeof(name), "chunk_%zu_speedup", chunk_sizes[i]);
+        report_add(report, "monte_carlo", name, serial / elapsed, "x");
+    }
+    yatpool_destroy(pool);
+}
+
+/// Lines of the writer scenario and the file they go to
+typedef struct {
+    char** lines;
+    size_t* lengths;
+    size_t* offsets;        // End of every chunk of lines in the file
+    char* file_buf;
+} WriterArg;
+
+/// Generate a range of lines of comma separated random numbers, seeded by
+/// line number so that every run writes the same file
+void generate_lines(size_t begin, size_t end, void* ctx) {
+    WriterArg* arg = (WriterArg*)ctx;
+    for (size_t i = begin; i < end; ++i) {
+        unsigned int seed = (unsigned int)i;
+        char* line = (char*)malloc(4 * WRITER_COLS + 1);
+        size_t length = 0;
+        for (size_t col = 0; col < WRITER_COLS; ++col)
+            length += sprintf(line + length, "%d,", rand_r(&seed) % WRITER_COLS);
+        line[length - 1] = '\n';
+        arg->lines[i] = line;
+        arg->lengths[i] = length;
+    }
+}
+
+/// Add up the length of every chunk of lines
+void measure_chunks(size_t begin, size_t end, void* ctx) {
+    WriterArg* arg = (WriterArg*)ctx;
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+        size_t size = 0;
+        for (size_t i = chunk * WRITER_LINES_PER_CHUNK;
+             i < (chunk + 1) * WRITER_LINES_PER_CHUNK && i < WRITER_LINES; ++i)
+            size += arg->lengths[i];
+        arg->offsets[chunk] = size;
+    }
+}
+
+void add_sizes(void* accum, const void* value, void* ctx) {
+    (void)ctx;
+    *(size_t*)accum += *(const size_t*)value;
+}
+
+/// Copy every chunk of lines to its place in the mapped file
+void write_chunks(size_t begin, size_t end, void* ctx) {
+    WriterArg* arg = (WriterArg*)ctx;
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+        char* out = arg->file_buf + (chunk == 0? 0: arg->offsets[chunk - 1]);
+        for (size_t i = chunk * WRITER_LINES_PER_CHUNK;
+             i < (chunk + 1) * WRITER_LINES_PER_CHUNK && i < WRITER_LINES; ++i) {
+            memcpy(out, arg->lines[i], arg->lengths[i]);
+            out += arg->lengths[i];
+        }
+    }
+}
+
+/// Generate the lines of the writer scenario and write them to a file
+/// through mmap, on the calling thread as writing_to_file_serial.c does if
+/// pool is NULL, or as writing_to_file_threaded.c does otherwise. Returns
+/// the time taken in nanoseconds, or a negative value on error.
+double write_file(YATPool* pool, const char* path) {
+    size_t num_chunks = (WRITER_LINES + WRITER_LINES_PER_CHUNK - 1) / WRITER_LINES_PER_CHUNK;
+    WriterArg arg;
+    arg.lines = (char**)malloc(WRITER_LINES * sizeof(char*));
+    arg.lengths = (size_t*)malloc(WRITER_LINES * sizeof(size_t));
+    arg.offsets = (size_t*)malloc(num_chunks * sizeof(size_t));
+    YATPoolSchedule one_chunk = {YATPOOL_SCHEDULE_DYNAMIC, 1};
+    YATPoolSchedule lines_chunk = {YATPOOL_SCHEDULE_DYNAMIC, WRITER_LINES_PER_CHUNK};
+    size_t zero = 0;
+
+    double start = now_ns();
+    if (pool == NULL) {
+        generate_lines(0, WRITER_LINES, &arg);
+        measure_chunks(0, num_chunks, &arg);
+        for (size_t chunk = 1; chunk < num_chunks; ++chunk)
+            arg.offsets[chunk] += arg.offsets[chunk - 1];
+    } else {
+        yatpool_parallel_for(pool, 0, WRITER_LINES, &generate_lines, &arg, lines_chunk);
+        yatpool_parallel_for(pool, 0, num_chunks, &measure_chunks, &arg, one_chunk);
+        yatpool_parallel_scan(pool, arg.offsets, arg.offsets, num_chunks, sizeof(size_t),
+                              &zero, &add_sizes, NULL, YATPOOL_SCAN_INCLUSIVE);
+    }
+
+    size_t file_size = arg.offsets[num_chunks - 1];
+    double elapsed = -1.0;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd != -1 && ftruncate(fd, file_size) == 0) {
+        arg.file_buf = (char*)mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (arg.file_buf != MAP_FAILED) {
+            if (pool == NULL)
+                write_chunks(0, num_chunks, &arg);
+            else
+                yatpool_parallel_for(pool, 0, num_chunks, &write_chunks, &arg, one_chunk);
+            munmap(arg.file_buf, file_size);
+            elapsed = now_ns() - start;
+        }
+    }
+    if (fd != -1)
+        close(fd);
+    unlink(path);
+
+    for (size_t i = 0; i < WRITER_LINES; ++i)
+        free(arg.lines[i]);
+    free(arg.lines);
+    free(arg.lengths);
+    free(arg.offsets);
+    return elapsed;
+}
+
+/// The mmap writer of the examples, serial and on the pool
+void bench_writer(const BenchConfig* config, Report* report) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/yatpool_bench_%ld.txt", config->dir, (long)getpid());
+
+    double serial = write_file(NULL, path);
+    YATPool* pool = bench_pool(config, YATPOOL_QUEUE_LOCKED);
+    double threaded = write_file(pool, path);
+    yatpool_destroy(pool);
+
+    if (serial < 0.0 || threaded < 0.0) {
+        fprintf(stderr, "Could not write %s, skipping the writer scenario.\n", path);
+        return;
+    }
+    report_add(report, "writer", "serial", serial / 1e6, "ms");
+    report_add(report, "writer", "threaded", threaded / 1e6, "ms");
+    report_add(report, "writer", "speedup", serial / threaded, "x");
+}
+
+/// Tasks per second a producer gets through a pool whose queue overflows,
+/// under every overflow policy and with yatpool_try_put, and the share of
+/// the tasks the policy had to deal with
+void bench_overflow(const BenchConfig* config, Report* report) {
+    YATPoolOverflow policies[] = {YATPOOL_OVERFLOW_BLOCK, YATPOOL_OVERFLOW_REJECT,
+                                  YATPOOL_OVERFLOW_CALLER_RUNS, YATPOOL_OVERFLOW_DROP_OLDEST};
+    const char* policy_names[] = {"block", "reject", "caller_runs", "drop_oldest"};
+    size_t spin = OVERFLOW_SPIN;
+
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) + 1; ++p) {
+        bool try_put = p == sizeof(policies) / sizeof(policies[0]);
+        YATPoolOptions options;
+        yatpool_options_init(&options, config->num_threads, 0);
+        options.queue_size = OVERFLOW_QUEUE_SIZE;
+        options.overflow = try_put? YATPOOL_OVERFLOW_BLOCK: policies[p];
+        YATPool* pool;
+        yatpool_init_with_options(&pool, &options);
+
+        // A task refused by yatpool_try_put is the producer's to free
+        size_t refused = 0;
+        double start = now_ns();
+        for (size_t i = 0; i < OVERFLOW_TASKS; ++i) {
+            Task* task;
+            yatpool_task_init_inline(pool, &task, &spin_task, &spin, sizeof(spin));
+            if (!try_put) {
+                yatpool_put(pool, task);
+            } else if (!yatpool_try_put(pool, task)) {
+                task_destroy(task);
+                refused++;
+            }
+        }
+        yatpool_quiesce(pool);
+        double seconds = (now_ns() - start) / 1e9;
+
+        YATPoolStats stats;
+        yatpool_stats(pool, &stats);
+        size_t handled = try_put? refused:
+                         stats.tasks_blocked + stats.tasks_rejected + stats.tasks_caller_ran + stats.tasks_dropped;
+        yatpool_stats_destroy(&stats);
+        yatpool_destroy(pool);
+
+        const char* policy_name = try_put? "try_put": policy_names[p];
+        char name[64];
+        snprintf(name, sizeof(name), "%s", policy_name);
+        report_add(report, "overflow", name, OVERFLOW_TASKS / seconds, "tasks/s");
+        snprintf(name, sizeof(name), "%s_overflowed", policy_name);
+        report_add(report, "overflow", name, 100.0 * handled / OVERFLOW_TASKS, "%");
+    }
+}
+
+/****************************************************************************/
+/*********************************Driver*************************************/
+/****************************************************************************/
+
+typedef struct {
+    const char* name;
+    void (*run)(const BenchConfig*, Report*);
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"submit", &bench_submit},
+    {"latency", &bench_latency},
+    {"fanout", &bench_fanout},
+    {"producers", &bench_producers},
+    {"monte_carlo", &bench_monte_carlo},
+    {"writer", &bench_writer},
+    {"overflow", &bench_overflow},
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-t threads] [-o results.json] [-d dir] [scenario...]\n", prog);
+    fprintf(stderr, "Scenarios:");
+    for (size_t i = 0; i < NUM_SCENARIOS; ++i)
+        fprintf(stderr, " %s", scenarios[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = {DEFAULT_THREADS, "."};
+    const char* output = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:o:d:h")) != -1) {
+        switch (opt) {
+        case 't':
+            config.num_threads = (size_t)atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'd':
+            config.dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h'? EXIT_SUCCESS: EXIT_FAILURE;
+        }
+    }
+    if (config.num_threads == 0) {
+        fprintf(stderr, "Must have at least one thread\n");
+        return EXIT_FAILURE;
+    }
+
+    // Without scenario names, every scenario runs
+    bool selected[NUM_SCENARIOS];
+    for (size_t i = 0; i < NUM_SCENARIOS; ++i)
+        selected[i] = optind == argc;
+    for (int arg = optind; arg < argc; ++arg) {
+        size_t i = 0;
+        while (i < NUM_SCENARIOS && strcmp(argv[arg], scenarios[i].name) != 0)
+            i++;
+        if (i == NUM_SCENARIOS) {
+            fprintf(stderr, "Unknown scenario %s\n", argv[arg]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        selected[i] = true;
+    }
+
+    Report report = {NULL, 0, 0};
+    for (size_t i = 0; i < NUM_SCENARIOS; ++i) {
+        if (selected[i])
+            scenarios[i].run(&config, &report);
+    }
+
+    FILE* file = output == NULL? stdout: fopen(output, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", output);
+        free(report.results);
+        return EXIT_FAILURE;
+    }
+    report_write(&report, &config, file);
+    if (file != stdout)
+        fclose(file);
+
+    free(report.results);
+    return EXIT_SUCCESS;
+}
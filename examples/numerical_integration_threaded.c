@@ -29,54 +29,53 @@
 
 typedef struct {
     double x_low, x_high, y_low, y_high;
-    size_t num_its;
-    size_t* hit_ctr_ptr;
 } HitCtrArg;
 
-void hitctrarg_init(HitCtrArg** arg, 
-                    double x_low, 
-                    double x_high, 
-                    double y_low, 
-                    double y_high, 
-                    size_t num_its, 
-                    size_t* hit_ctr_ptr) {
-    if (arg==NULL || hit_ctr_ptr==NULL) return;
-    *arg = (HitCtrArg*)malloc(sizeof(HitCtrArg));
-    (*arg)->x_low = x_low;
-    (*arg)->x_high = x_high;
-    (*arg)->y_low = y_low;
-    (*arg)->y_high = y_high;
-    (*arg)->num_its = num_its;
-    (*arg)->hit_ctr_ptr = hit_ctr_ptr;
+/// Function to be integrated
+double func(double x) {
+    return 9.0 - x * x;
 }
 
-void hitctrarg_destroy(void* arg) {
-    if (arg==NULL) return;
-    HitCtrArg* _arg = (HitCtrArg*)arg;
-    free(_arg);
+/// Give every worker a random number stream of its own
+void* seed_init(size_t worker_id, void* arg) {
+    (void)arg;
+    unsigned int* seed = (unsigned int*)malloc(sizeof(unsigned int));
+    *seed = 42 + (unsigned int)worker_id;
+    return seed;
 }
 
-/// Function to be integrated
-double func(double x) {
-    return 9.0 - x * x;
+/// Free the random number stream of a worker
+void seed_teardown(void* ctx, void* arg) {
+    (void)arg;
+    free(ctx);
 }
 
-/// Function that counts number of hits within range
-void* count_hits(void* arg) {
-    HitCtrArg* _arg = (HitCtrArg*)arg;
+/// Kernel that adds the number of hits within range for a range of
+/// iterations to a partial count
+void count_hits(size_t start, size_t end, void* partial, void* ctx) {
+    HitCtrArg* _arg = (HitCtrArg*)ctx;
 
     size_t hits = 0;
-    
-    unsigned int seed = 42;
-    for (size_t i=0; i<_arg->num_its; ++i) {
-        double x = _arg->x_low + (double)rand_r(&seed)/(double)RAND_MAX * (_arg->x_high - _arg->x_low);
-        double y = _arg->y_low + (double)rand_r(&seed)/(double)RAND_MAX * (_arg->y_high - _arg->y_low);
+
+    // Workers draw from their own stream; the calling thread, which takes
+    // part in the loop as well, seeds one for its range
+    unsigned int local_seed = 42 + start;
+    unsigned int* seed = (unsigned int*)yatpool_worker_ctx();
+    if (seed == NULL)
+        seed = &local_seed;
+    for (size_t i=start; i<end; ++i) {
+        double x = _arg->x_low + (double)rand_r(seed)/(double)RAND_MAX * (_arg->x_high - _arg->x_low);
+        double y = _arg->y_low + (double)rand_r(seed)/(double)RAND_MAX * (_arg->y_high - _arg->y_low);
         if (y <= func(x))
             hits++;
-        seed *= i;
     }
-    *(_arg->hit_ctr_ptr) = hits;
-    return NULL;
+    *(size_t*)partial += hits;
+}
+
+/// Combine two partial hit counts
+void add_hits(void* accum, const void* value, void* ctx) {
+    (void)ctx;
+    *(size_t*)accum += *(const size_t*)value;
 }
 
 int main(int argc, char** argv) {
@@ -97,30 +96,26 @@ int main(int argc, char** argv) {
     double y_low = func(x_low);
     double y_high = func(x_high);
 
-    size_t* hits = (size_t*)calloc(num_threads, sizeof(size_t));
-    
     YATPool* pool;
-    yatpool_init(&pool, num_threads, num_threads);
-
-    for (size_t i=0; i<num_threads; ++i) {
-        Task* task;
-        HitCtrArg* arg;
-        hitctrarg_init(&arg, x_low, x_high, y_low, y_high, num_its, &hits[i]);
-        task_init(&task, &count_hits, arg, &hitctrarg_destroy);
-        yatpool_put(pool, task);
-    }
+    // No tasks are submitted directly, so the pool needs no result array
+    YATPoolOptions options;
+    yatpool_options_init(&options, num_threads, 0);
+    options.worker_init = &seed_init;
+    options.worker_teardown = &seed_teardown;
+    yatpool_init_with_options(&pool, &options);
+
+    // Every thread counts hits into a partial of its own, and the partials
+    // are added up at the end
+    HitCtrArg arg = {x_low, x_high, y_low, y_high};
+    size_t no_hits = 0, total_hits = 0;
+    YATPoolSchedule schedule = {YATPOOL_SCHEDULE_STATIC, 0};
+    yatpool_parallel_reduce(pool, 0, num_its * num_threads, &no_hits, sizeof(size_t),
+                            &count_hits, &add_hits, &arg, schedule, &total_hits);
 
-    yatpool_wait(pool);
     yatpool_destroy(pool);
 
-    size_t total_hits = 0;
-    for (size_t i=0; i<num_threads; ++i)
-        total_hits += hits[i];
-
     printf("Numerically calculated = %f\n", (double)total_hits / (double)(num_its * num_threads) * (y_low-y_high) * (x_high-x_low));
     printf("Analytical solution = %f\n", 9.0 * (x_high - x_low) - (x_high * x_high * x_high - x_low * x_low * x_low) / 3.0);
-    
-    free(hits);
 
     return EXIT_SUCCESS;
 }
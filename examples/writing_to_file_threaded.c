@@ -44,25 +44,19 @@ typedef struct {
     String* line;
 } Line;
 
-typedef struct {
-    Line** lines;
-    size_t start_lineno;
-    size_t end_lineno;
-} GenerateLinesArg;
-
 typedef struct {
     Line** lines;
     size_t start_lineno;
     size_t end_lineno;
     size_t* offset_ptr;
-} GetOffsetArg;
+} ChunkArg;
 
 typedef struct {
     char* mapped_file;
     Line** lines;
-    size_t start_lineno;
-    size_t end_lineno;
-    size_t offset;
+    size_t* offsets;
+    size_t lines_per_chunk;
+    size_t num_lines;
 } WriteToFileArg;
 
 String string_create(const char* str, size_t length) {
@@ -101,75 +95,39 @@ void line_destroy(Line* line) {
     free(line->line);
 }
 
-void generatelinesarg_init(GenerateLinesArg** arg, Line** lines, size_t start_lineno, size_t end_lineno) {
-    if (arg==NULL || lines==NULL) return;
-    GenerateLinesArg** _arg = (GenerateLinesArg**)arg;
-    *_arg = (GenerateLinesArg*)malloc(sizeof(GenerateLinesArg));
-    (*_arg)->lines = lines;
-    (*_arg)->start_lineno = start_lineno;
-    (*_arg)->end_lineno = end_lineno;
-}
-
-void generatelinesarg_destroy(void* arg) {
-    if (arg==NULL) return;
-    GenerateLinesArg* _arg = (GenerateLinesArg*)arg;
-    free(_arg);
-}
-
-void getoffsetarg_init(GetOffsetArg** arg, 
-                       Line** lines, 
-                       size_t start_lineno,
-                       size_t end_lineno,
-                       size_t* offset_ptr) {
-    if (arg==NULL) return;
-    if (lines==NULL) return;
-    *arg = (GetOffsetArg*)malloc(sizeof(GetOffsetArg));
-    (*arg)->lines = lines;
-    (*arg)->start_lineno = start_lineno;
-    (*arg)->end_lineno = end_lineno;
-    (*arg)->offset_ptr = offset_ptr;
-}
-
-void getoffsetarg_destroy(void* arg) {
-    if (arg==NULL) return;
-    GetOffsetArg* _arg = (GetOffsetArg*)arg;
-    free(_arg);
+/// Give every worker a random number stream of its own, so that the
+/// workers do not contend for the lock of rand()
+void* seed_init(size_t worker_id, void* arg) {
+    (void)arg;
+    unsigned int* seed = (unsigned int*)malloc(sizeof(unsigned int));
+    *seed = (unsigned int)worker_id + 1;
+    return seed;
 }
 
-void writetofilearg_init(WriteToFileArg** arg,
-                         char* mapped,
-                         Line** lines,
-                         size_t start_lineno,
-                         size_t end_lineno,
-                         size_t offset) {
-    if (arg==NULL || mapped==NULL || lines==NULL) return;
-    *arg = (WriteToFileArg*)malloc(sizeof(WriteToFileArg));
-    (*arg)->mapped_file = mapped;
-    (*arg)->lines = lines;
-    (*arg)->start_lineno = start_lineno;
-    (*arg)->end_lineno = end_lineno;
-    (*arg)->offset = offset;
+/// Free the random number stream of a worker
+void seed_teardown(void* ctx, void* arg) {
+    (void)arg;
+    free(ctx);
 }
 
-void writetofilearg_destroy(void* arg) {
-    if (arg==NULL) return;
-    WriteToFileArg* _arg = (WriteToFileArg*)arg;
-    free(_arg);
-}
-
-/// Function for threadpool to generate a bunch of lines of data
-void* generate_lines(void* arg) {
-    GenerateLinesArg* lnarg = (GenerateLinesArg*)arg;
+/// Generate a range of lines of data
+void generate_lines(size_t start_lineno, size_t end_lineno, void* ctx) {
+    Line** lines = (Line**)ctx;
     
-    for (size_t i=lnarg->start_lineno; i<lnarg->end_lineno; ++i) {
-        line_init(&(lnarg->lines[i]), i+1);
+    unsigned int local_seed = (unsigned int)start_lineno;
+    unsigned int* seed = (unsigned int*)yatpool_worker_ctx();
+    if (seed == NULL)
+        seed = &local_seed;
+
+    for (size_t i=start_lineno; i<end_lineno; ++i) {
+        line_init(&(lines[i]), i+1);
 
         char* joined = NULL;
         size_t buflen = 0;
         for (int i=0; i<NCOLS; ++i) {
             char num_str[MAX_BUFLEN];
             memset(num_str, '\0', sizeof(num_str));
-            sprintf(num_str, "%d,", rand()%NCOLS);
+            sprintf(num_str, "%d,", rand_r(seed)%NCOLS);
             buflen += strlen(num_str);
 
             if (joined==NULL) {
@@ -183,35 +141,51 @@ void* generate_lines(void* arg) {
         joined[buflen-1] = '\n';
         joined = (char*)realloc(joined, (buflen+1) * sizeof(char));
         joined[buflen] = '\0';
-        *(lnarg->lines[i]->line) = string_create(joined, buflen);
+        *(lines[i]->line) = string_create(joined, buflen);
 
         free(joined);
     }
+}
 
+/// Function for threadpool to generate a group of lines
+void* generate_chunk(void* arg) {
+    ChunkArg* chunkarg = (ChunkArg*)arg;
+    generate_lines(chunkarg->start_lineno, chunkarg->end_lineno, chunkarg->lines);
     return NULL;
 }
 
 /// Function for threadpool to calculate the offset required for a group of lines
 void* get_offset(void* arg) {
-    GetOffsetArg* offsetarg = (GetOffsetArg*)arg;
+    ChunkArg* offsetarg = (ChunkArg*)arg;
     *(offsetarg->offset_ptr) = 0;
     for (size_t i = offsetarg->start_lineno; i < offsetarg->end_lineno; ++i)
         *(offsetarg->offset_ptr) += offsetarg->lines[i]->line->length;
     return NULL;
 }
 
-/// Function for threadpool to write a chunk of lines into file
-void* write_to_file(void* arg) {
-    WriteToFileArg* currarg = (WriteToFileArg*)arg;
+/// Combine function for threadpool to add up chunk sizes
+void add_offsets(void* accum, const void* value, void* ctx) {
+    (void)ctx;
+    *(size_t*)accum += *(const size_t*)value;
+}
+
+/// Loop body for threadpool to write a range of chunks of lines into file
+void write_to_file(size_t start_chunk, size_t end_chunk, void* ctx) {
+    WriteToFileArg* arg = (WriteToFileArg*)ctx;
+
+    for (size_t chunk = start_chunk; chunk < end_chunk; ++chunk) {
+        size_t start_lineno = arg->lines_per_chunk * chunk;
+        size_t end_lineno = arg->lines_per_chunk * (chunk + 1);
+        end_lineno = end_lineno > arg->num_lines? arg->num_lines: end_lineno;
 
-    size_t running_total_bytes = 0;
-    currarg->mapped_file += currarg->offset;
+        char* mapped_file = arg->mapped_file + ((chunk == 0)? 0: arg->offsets[chunk-1]);
+        size_t running_total_bytes = 0;
 
-    for (size_t i = currarg->start_lineno; i < currarg->end_lineno; ++i) {
-        memcpy(currarg->mapped_file+running_total_bytes, currarg->lines[i]->line->data, currarg->lines[i]->line->length);
-        running_total_bytes += currarg->lines[i]->line->length;
+        for (size_t i = start_lineno; i < end_lineno; ++i) {
+            memcpy(mapped_file+running_total_bytes, arg->lines[i]->line->data, arg->lines[i]->line->length);
+            running_total_bytes += arg->lines[i]->line->length;
+        }
     }
-    return NULL;
 }
 
 /// Comparison function for two Line objects in qsort
@@ -242,30 +216,41 @@ int main(int argc, char** argv) {
 
     YATPool* pool;
    
-    // Generate data in parallel
     Line** generated = (Line**)calloc(num_lines, sizeof(Line*));
     
     size_t fac = 8 * num_threads;
     size_t num_tasks = num_lines / fac;
     num_tasks = num_lines % fac == 0 ? num_tasks: num_tasks + 1;
     
-    yatpool_init(&pool, num_threads, num_tasks);
+    // One task generates each group of lines, and another one calculates
+    // the offset required for it
+    YATPoolOptions options;
+    yatpool_options_init(&options, num_threads, 2 * num_tasks);
+    options.worker_init = &seed_init;
+    options.worker_teardown = &seed_teardown;
+    yatpool_init_with_options(&pool, &options);
     
-    for(int i = 0; i < (int)num_tasks; ++i) {
-        Task* task;
-        GenerateLinesArg* arg;
+    size_t* offsets = (size_t*)calloc(num_tasks, sizeof(size_t));
+    memset(offsets, 0, num_tasks * sizeof(size_t));
 
+    // The offset of a group is calculated as soon as its lines have been
+    // generated, without waiting for the other groups
+    for (size_t i = 0; i < num_tasks; ++i) {
+        Task* generate_task;
+        Task* offset_task;
         size_t start_lineno = fac * i;
         size_t end_lineno = fac * (i + 1);
         end_lineno = end_lineno > (size_t)num_lines? num_lines: end_lineno;
-        generatelinesarg_init(&arg, generated, start_lineno, end_lineno);
-        
-        task_init(&task, &generate_lines, arg, &generatelinesarg_destroy);
-        yatpool_put(pool, task);
+        ChunkArg arg = {generated, start_lineno, end_lineno, &offsets[i]};
+
+        task_init_inline(&generate_task, &generate_chunk, &arg, sizeof(arg));
+        task_init_inline(&offset_task, &get_offset, &arg, sizeof(arg));
+        task_depends_on(offset_task, generate_task);
+        yatpool_put(pool, offset_task);
+        yatpool_put(pool, generate_task);
     }
 
     yatpool_wait(pool);
-    yatpool_destroy(pool);
     
     // Sort data so that it is in the correct order
     qsort(generated, num_lines, sizeof(Line*), cmp_lines);
@@ -277,37 +262,16 @@ int main(int argc, char** argv) {
 
     gettimeofday(&start, NULL);
 
-    num_tasks = num_lines / fac;
-    num_tasks = num_lines % fac == 0 ? num_tasks: num_tasks + 1;
-    
-    // Calculate offsets for each group of lines to write
-    size_t* offsets = (size_t*)calloc(num_tasks, sizeof(size_t));
-    memset(offsets, 0, num_tasks * sizeof(size_t));
-
-    yatpool_init(&pool, num_threads, num_tasks);
-
-    for (size_t i = 0; i < num_tasks; ++i) {
-        Task* task;
-        GetOffsetArg* arg;
-        size_t start_lineno = fac * i;
-        size_t end_lineno = fac * (i + 1);
-        end_lineno = end_lineno > (size_t)num_lines? num_lines: end_lineno;
-        getoffsetarg_init(&arg, generated, start_lineno, end_lineno, &offsets[i]);
-
-        task_init(&task, &get_offset, arg, &getoffsetarg_destroy);
-        yatpool_put(pool, task);
-    }
-
-    yatpool_wait(pool);
-    yatpool_destroy(pool);
-
-    for (size_t i=1; i<num_tasks; ++i)
-        offsets[i] += offsets[i-1];
+    // Offset of the end of each chunk is the running total of chunk sizes
+    size_t zero = 0;
+    yatpool_parallel_scan(pool, offsets, offsets, num_tasks, sizeof(size_t),
+                          &zero, &add_offsets, NULL, YATPOOL_SCAN_INCLUSIVE);
 
     // Write data in parallel to file
     int fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
     if (fd==-1) {
         fprintf(stderr, "Could not open file %s.\n", argv[1]);
+        yatpool_destroy(pool);
         return EXIT_FAILURE;
     }
 
@@ -316,6 +280,7 @@ int main(int argc, char** argv) {
     if (ftruncate(fd, file_size)==-1) {
         fprintf(stderr, "Error truncating file to specified length.\n");
         close(fd);
+        yatpool_destroy(pool);
         return EXIT_FAILURE;
     }
 
@@ -323,25 +288,13 @@ int main(int argc, char** argv) {
     if (file_buf == MAP_FAILED) {
         fprintf(stderr, "Error in mmap to file.\n");
         close(fd);
+        yatpool_destroy(pool);
         return EXIT_FAILURE;
     }
 
-    yatpool_init(&pool, num_threads, num_tasks);
-    
-    for (size_t i = 0; i < num_tasks; ++i) {
-        Task* task;
-        WriteToFileArg* arg;
-        size_t start_lineno = fac * i;
-        size_t end_lineno = fac * (i + 1);
-        end_lineno = end_lineno > (size_t)num_lines? num_lines: end_lineno;
-        size_t offset = (i == 0)? 0: offsets[i-1];
-        writetofilearg_init(&arg, file_buf, generated, start_lineno, end_lineno, offset);
-
-        task_init(&task, &write_to_file, arg, &writetofilearg_destroy);
-        yatpool_put(pool, task);
-    }
-
-    yatpool_wait(pool);
+    WriteToFileArg arg = {file_buf, generated, offsets, fac, (size_t)num_lines};
+    YATPoolSchedule one_chunk = {YATPOOL_SCHEDULE_DYNAMIC, 1};
+    yatpool_parallel_for(pool, 0, num_tasks, &write_to_file, &arg, one_chunk);
     yatpool_destroy(pool);
 
     munmap(file_buf, file_size);
@@ -20,6 +20,15 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "yatpool.h"
 
 #define ERR(msg) fprintf(stderr, "%s, line %d: Error: %s\n", __FILE__, __LINE__, msg);
@@ -28,17 +37,18 @@
     exit(1); \
 }
 
-/// Size of the task queue of a threadpool
-#define MAX_QUEUE_SIZE 100
-
 /****************************************************************************/
 /******************************Task queue************************************/
 /****************************************************************************/
 
 #define EMPTY_QUEUE_VALUE 0
 
+/// Bounded FIFO queue stored as a circular buffer, so that put and pop
+/// never move the elements already in the queue. Only the size may be read
+/// without holding the lock that guards the queue.
 typedef struct queue {
     size_t length, curr_size;
+    size_t head;
     void** data;
 } TaskQueue;
 
@@ -51,6 +61,7 @@ void taskqueue_init(TaskQueue** q, size_t length) {
     (*q)->data = (void**)calloc(length, sizeof(void *));
     (*q)->length = length;
     (*q)->curr_size = 0;
+    (*q)->head = 0;
 }
 
 /// Add a value to the queue
@@ -66,8 +77,11 @@ bool taskqueue_put(TaskQueue *q, void* value) {
     if ((q->curr_size + 1) > q->length) {
         return false;
     }
-    q->data[q->curr_size] = value;
-    (q->curr_size)++;
+    size_t tail = q->head + q->curr_size;
+    if (tail >= q->length)
+        tail -= q->length;
+    q->data[tail] = value;
+    __atomic_store_n(&q->curr_size, q->curr_size + 1, __ATOMIC_RELAXED);
 
     return true;
 }
@@ -75,7 +89,7 @@ bool taskqueue_put(TaskQueue *q, void* value) {
 /// Get the current size of the queue
 size_t taskqueue_size(TaskQueue *q) {
     if (q == NULL) ERR_AND_EXIT("Null value for queue pointer provided.");
-    return q->curr_size;
+    return __atomic_load_n(&q->curr_size, __ATOMIC_RELAXED);
 }
 
 /// Get the first element of the queue
@@ -84,7 +98,7 @@ void* taskqueue_get(TaskQueue *q) {
     if (q->curr_size == 0) {
         return EMPTY_QUEUE_VALUE;
     }
-    return q->data[0];
+    return q->data[q->head];
 }
 
 
@@ -95,11 +109,12 @@ void* taskqueue_pop(TaskQueue *q) {
         return EMPTY_QUEUE_VALUE;
     }
 
-    void* elem = q->data[0];
-    for (size_t i = 0; i < q->curr_size - 1; i++) {
-        q->data[i] = q->data[i + 1];
-    }
-    q->curr_size--;
+    void* elem = q->data[q->head];
+    q->data[q->head] = NULL;
+    q->head++;
+    if (q->head == q->length)
+        q->head = 0;
+    __atomic_store_n(&q->curr_size, q->curr_size - 1, __ATOMIC_RELAXED);
     return elem;
 }
 
@@ -115,48 +130,579 @@ bool taskqueue_full(TaskQueue *q) {
     return (q->curr_size) == (q->length);
 }
 
-/// Clear the task queue
+/// Clear the task queue, destroying the tasks left in it
 void taskqueue_clear(TaskQueue *q) {
     if (q == NULL) ERR_AND_EXIT("Null value for queue pointer provided.");
-    for (size_t i=0; i<q->curr_size; ++i)
-        free(q->data[i]);
-    q->curr_size = 0;
+    while (!taskqueue_empty(q))
+        task_destroy((Task *)taskqueue_pop(q));
+    q->head = 0;
 }
 
 /// Destroy a TaskQueue instance
 void taskqueue_destroy(TaskQueue *q) {
     if (q == NULL) ERR_AND_EXIT("Null value for queue pointer provided.");
     
-    for (size_t i=0; i<q->curr_size; ++i)
-        free(q->data[i]);
+    taskqueue_clear(q);
     free(q->data);
     free(q);
 }
 
+/****************************************************************************/
+/****************************Lock-free task queue****************************/
+/****************************************************************************/
+
+/// Slot of an MPMCQueue. seq tells producers and consumers whose turn it is
+/// to use the slot for a given position.
+typedef struct mpmc_cell {
+    size_t seq;
+    void* data;
+} MPMCCell;
+
+/// Bounded multi-producer/multi-consumer queue after Dmitry Vyukov. Each
+/// operation claims a position with one CAS and never takes a lock.
+typedef struct mpmc_queue {
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    MPMCCell* cells __attribute__((aligned(64)));
+    size_t length;
+} MPMCQueue;
+
+/// Initialize an MPMCQueue. The length is rounded up to a power of two.
+void mpmcqueue_init(MPMCQueue** q, size_t length) {
+    assert(length);
+
+    size_t size = 2;
+    while (size < length)
+        size *= 2;
+
+    if (posix_memalign((void**)q, 64, sizeof(MPMCQueue)) != 0)
+        ERR_AND_EXIT("Could not allocate queue.");
+    (*q)->cells = (MPMCCell*)malloc(size * sizeof(MPMCCell));
+    for (size_t i = 0; i < size; ++i) {
+        (*q)->cells[i].seq = i;
+        (*q)->cells[i].data = NULL;
+    }
+    (*q)->length = size;
+    (*q)->enqueue_pos = 0;
+    (*q)->dequeue_pos = 0;
+}
+
+/// Add a value to the queue. Returns false if the queue is full.
+bool mpmcqueue_put(MPMCQueue* q, void* value) {
+    size_t mask = q->length - 1;
+    size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+        MPMCCell* cell = &q->cells[pos & mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                cell->data = value;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/// Get the first element and remove it from the queue. Returns
+/// EMPTY_QUEUE_VALUE if the queue is empty.
+void* mpmcqueue_pop(MPMCQueue* q) {
+    size_t mask = q->length - 1;
+    size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+        MPMCCell* cell = &q->cells[pos & mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                void* elem = cell->data;
+                __atomic_store_n(&cell->seq, pos + mask + 1, __ATOMIC_RELEASE);
+                return elem;
+            }
+        } else if (diff < 0) {
+            return EMPTY_QUEUE_VALUE;
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/// Get the approximate number of elements in the queue
+size_t mpmcqueue_size(MPMCQueue* q) {
+    size_t head = __atomic_load_n(&q->dequeue_pos, __ATOMIC_SEQ_CST);
+    size_t tail = __atomic_load_n(&q->enqueue_pos, __ATOMIC_SEQ_CST);
+    return tail > head ? tail - head : 0;
+}
+
+/// Destroy an MPMCQueue instance and the tasks left in it
+void mpmcqueue_destroy(MPMCQueue* q) {
+    if (q == NULL) ERR_AND_EXIT("Null value for queue pointer provided.");
+
+    void* elem;
+    while ((elem = mpmcqueue_pop(q)) != EMPTY_QUEUE_VALUE)
+        task_destroy((Task *)elem);
+    free(q->cells);
+    free(q);
+}
+
+/****************************************************************************/
+/*****************************Work-stealing deque****************************/
+/****************************************************************************/
+
+/// Initial number of slots in a work-stealing deque
+#define DEQUE_INITIAL_SIZE 64
+
+/// Circular array backing a TaskDeque. Arrays replaced by a larger one are
+/// kept on the prev list until the deque is destroyed, because a thief may
+/// still be reading from them.
+typedef struct deque_array {
+    size_t size;
+    void** data;
+    struct deque_array* prev;
+} DequeArray;
+
+/// Chase-Lev work-stealing deque. The owning worker pushes and takes at the
+/// bottom without locking, other workers steal from the top.
+typedef struct deque {
+    long top __attribute__((aligned(64)));
+    long bottom __attribute__((aligned(64)));
+    DequeArray* array;
+} TaskDeque;
+
+/// Allocate a DequeArray with the given number of slots
+DequeArray* _dequearray_create(size_t size, DequeArray* prev) {
+    DequeArray* a = (DequeArray*)malloc(sizeof(DequeArray));
+    a->size = size;
+    a->data = (void**)calloc(size, sizeof(void *));
+    a->prev = prev;
+    return a;
+}
+
+/// Initialize a TaskDeque
+void taskdeque_init(TaskDeque** d) {
+    if (posix_memalign((void**)d, 64, sizeof(TaskDeque)) != 0)
+        ERR_AND_EXIT("Could not allocate deque.");
+    (*d)->top = 0;
+    (*d)->bottom = 0;
+    (*d)->array = _dequearray_create(DEQUE_INITIAL_SIZE, NULL);
+}
+
+/// Push a value at the bottom of the deque. Only the owner may call this.
+void taskdeque_push(TaskDeque* d, void* value) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    DequeArray* a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+    if (b - t > (long)a->size - 1) {
+        // Full: move the live elements into an array twice as large
+        DequeArray* grown = _dequearray_create(2 * a->size, a);
+        for (long i = t; i < b; ++i)
+            grown->data[i & (grown->size - 1)] = 
+                __atomic_load_n(&a->data[i & (a->size - 1)], __ATOMIC_RELAXED);
+        __atomic_store_n(&d->array, grown, __ATOMIC_RELEASE);
+        a = grown;
+    }
+    __atomic_store_n(&a->data[b & (a->size - 1)], value, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+/// Take the most recently pushed value from the bottom of the deque. Only
+/// the owner may call this.
+void* taskdeque_take(TaskDeque* d) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    DequeArray* a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    void* elem = EMPTY_QUEUE_VALUE;
+    if (t <= b) {
+        elem = __atomic_load_n(&a->data[b & (a->size - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            // Last element: race against thieves for it
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, 
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                elem = EMPTY_QUEUE_VALUE;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return elem;
+}
+
+/// Steal the oldest value from the top of the deque. Any thread may call
+/// this. Returns EMPTY_QUEUE_VALUE if the deque is empty or the steal lost
+/// a race.
+void* taskdeque_steal(TaskDeque* d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b)
+        return EMPTY_QUEUE_VALUE;
+
+    DequeArray* a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+    void* elem = __atomic_load_n(&a->data[t & (a->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, 
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return EMPTY_QUEUE_VALUE;
+    return elem;
+}
+
+/// Check if the deque looks empty. The answer may be stale by the time the
+/// caller acts on it.
+bool taskdeque_empty(TaskDeque* d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+    return b <= t;
+}
+
+/// Destroy a TaskDeque instance and the tasks left in it
+void taskdeque_destroy(TaskDeque* d) {
+    if (d == NULL) ERR_AND_EXIT("Null value for deque pointer provided.");
+
+    void* elem;
+    while ((elem = taskdeque_take(d)) != EMPTY_QUEUE_VALUE)
+        task_destroy((Task *)elem);
+
+    DequeArray* a = d->array;
+    while (a != NULL) {
+        DequeArray* prev = a->prev;
+        free(a->data);
+        free(a);
+        a = prev;
+    }
+    free(d);
+}
+
+/****************************************************************************/
+/*******************************CPU topology*********************************/
+/****************************************************************************/
+
+/// Directory where Linux lists the NUMA nodes of the machine
+#define NODE_SYSFS_DIR "/sys/devices/system/node"
+
+/// Parse a sysfs CPU list such as "0-3,8-11" into a CPU set
+void _cpulist_parse(const char* list, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    while (*list != '\0' && *list != '\n') {
+        char* next;
+        long first = strtol(list, &next, 10);
+        long last = first;
+        if (next == list)
+            break;
+        if (*next == '-')
+            last = strtol(next + 1, &next, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, cpus);
+        list = (*next == ',')? next + 1: next;
+    }
+}
+
+/// NUMA node listed in sysfs
+typedef struct numa_node {
+    int id;
+    cpu_set_t cpus;
+} NumaNode;
+
+/// Order NUMA nodes by id
+int _topology_cmp_nodes(const void* a, const void* b) {
+    int x = ((const NumaNode*)a)->id, y = ((const NumaNode*)b)->id;
+    return (x > y) - (x < y);
+}
+
+/// Find the NUMA nodes the calling process may run on, sorted by id, with
+/// the id and the CPUs of each. readdir lists them in no particular order.
+/// Falls back to a single node 0 holding all allowed CPUs when sysfs does
+/// not list any node. Returns the number of nodes.
+size_t _topology_discover_nodes(cpu_set_t** node_cpus, int** node_ids) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        ERR_AND_EXIT("Could not get the CPU affinity of the process.");
+
+    size_t num_nodes = 0;
+    NumaNode* nodes = NULL;
+
+    DIR* dir = opendir(NODE_SYSFS_DIR);
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int node;
+            if (sscanf(entry->d_name, "node%d", &node) != 1)
+                continue;
+
+            char path[128], list[4096];
+            snprintf(path, sizeof(path), NODE_SYSFS_DIR "/node%d/cpulist", node);
+            FILE* file = fopen(path, "r");
+            if (file == NULL)
+                continue;
+            bool read = fgets(list, sizeof(list), file) != NULL;
+            fclose(file);
+            if (!read)
+                continue;
+
+            // Only the CPUs the process may run on count; nodes without
+            // any are left out
+            cpu_set_t cpus;
+            _cpulist_parse(list, &cpus);
+            CPU_AND(&cpus, &cpus, &allowed);
+            if (CPU_COUNT(&cpus) == 0)
+                continue;
+
+            nodes = (NumaNode*)realloc(nodes, (num_nodes + 1) * sizeof(NumaNode));
+            nodes[num_nodes].id = node;
+            nodes[num_nodes++].cpus = cpus;
+        }
+        closedir(dir);
+    }
+
+    if (num_nodes == 0) {
+        nodes = (NumaNode*)malloc(sizeof(NumaNode));
+        nodes[0].id = 0;
+        nodes[0].cpus = allowed;
+        num_nodes = 1;
+    }
+    qsort(nodes, num_nodes, sizeof(NumaNode), &_topology_cmp_nodes);
+
+    *node_cpus = (cpu_set_t*)malloc(num_nodes * sizeof(cpu_set_t));
+    *node_ids = (int*)malloc(num_nodes * sizeof(int));
+    for (size_t i = 0; i < num_nodes; ++i) {
+        (*node_cpus)[i] = nodes[i].cpus;
+        (*node_ids)[i] = nodes[i].id;
+    }
+    free(nodes);
+    return num_nodes;
+}
+
 /****************************************************************************/
 /******************************Thread pool***********************************/
 /****************************************************************************/
 
+/// Hint to the CPU that the thread is busy-waiting
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX() do {} while (0)
+#endif
+
+/// Number of times a priority lane holding tasks may be passed over for
+/// higher priority lanes before it is served
+#define PRIORITY_AGING_LIMIT 16
+
+/// Number of tasks allocated at once when a task slab runs dry
+#define SLAB_CHUNK_SIZE 64
+/// Number of free tasks a worker keeps before returning half to the pool
+#define SLAB_CACHE_SIZE 256
+
+/// Number of counters the threads outside a pool spread their submissions
+/// over
+#define PRODUCER_SLOTS 16
+
+#ifdef YATPOOL_TRACE
+/// Number of task events each worker keeps for yatpool_trace_dump; older
+/// ones are overwritten
+#define TRACE_BUFFER_SIZE 16384
+
+/// Lifecycle of one task executed by a worker
+typedef struct trace_event {
+    const char* label;
+    uint64_t submit_ns, dequeue_ns, start_ns, end_ns;
+} TraceEvent;
+
+/// Ring of the latest task events of a worker. Only the worker writes to
+/// it, so recording an event takes no lock.
+typedef struct trace_buffer {
+    TraceEvent* events;
+    size_t head;                // Number of events ever recorded
+} TraceBuffer;
+
+#define TRACE_TASK_INIT(task) ((task)->label = NULL)
+#define TRACE_SUBMIT(task) ((task)->submit_ns = _yatpool_now_ns())
+#define TRACE_BEGIN(event, task, dequeue_ns) \
+    TraceEvent event = {(task)->label, (task)->submit_ns, (dequeue_ns), _yatpool_now_ns(), 0}
+#define TRACE_END(pool, worker, event, end_ns) _yatpool_trace_record((pool), (worker), &(event), (end_ns))
+#else
+#define TRACE_TASK_INIT(task) do {} while (0)
+#define TRACE_SUBMIT(task) do {} while (0)
+#define TRACE_BEGIN(event, task, dequeue_ns) do {} while (0)
+#define TRACE_END(pool, worker, event, end_ns) do {} while (0)
+#endif
+
+/// Block of task objects allocated together by a task slab
+typedef struct slab_chunk {
+    Task* tasks;
+    struct slab_chunk* next;
+} SlabChunk;
+
+/// Lifecycle of a worker slot
+typedef enum {
+    WORKER_UNUSED,              // No thread was started in the slot yet
+    WORKER_RUNNING,
+    WORKER_RETIRED              // The thread has exited and waits to be joined
+} WorkerState;
+
+/// Per-thread state of a worker. Aligned to a cache line so that workers
+/// updating their own fields do not slow each other down.
+typedef struct worker {
+    YATPool* pool;
+    size_t id;
+    size_t node;
+    void* ctx;                  // Returned by the worker_init hook
+    int state;                  // WorkerState of the slot
+    int parked;                 // Futex word, set while the worker is on the idle list
+    TaskDeque* deque;
+    unsigned int seed;
+    Task* free_tasks;
+    size_t num_free_tasks;
+    size_t slab_hits, slab_misses;
+    size_t tasks_executed, steals;
+    size_t tasks_submitted;     // Tasks the worker submitted to its own pool
+    uint64_t busy_ns, idle_ns;
+#ifdef YATPOOL_TRACE
+    TraceBuffer trace;
+#endif
+} __attribute__((aligned(64))) Worker;
+
+/// Count of the tasks submitted by the threads outside a pool that were
+/// given the slot. Aligned to a cache line so that producers on different
+/// slots do not slow each other down.
+typedef struct producer_slot {
+    size_t tasks_submitted;
+} __attribute__((aligned(64))) ProducerSlot;
+
+/// Record of the tasks run by threads outside a pool, while they wait for a
+/// group or a loop or when a full queue makes them run their own task.
+/// Several threads may write to it.
+typedef struct caller_record {
+    size_t tasks_executed;
+    uint64_t busy_ns;
+#ifdef YATPOOL_TRACE
+    TraceBuffer trace;
+    pthread_mutex_t trace_mutex;
+#endif
+} CallerRecord;
+
 /// Threadpool struct definition
 typedef struct yatpool {
     pthread_t* threads;
-    size_t pool_size;
-    TaskQueue* task_queue;
+    Worker* workers;                // One slot per thread the pool may grow to
+    CallerRecord callers;
+    size_t pool_size;               // Number of live workers
+    size_t min_threads, max_threads;
+    size_t grow_queue_depth;        // Queue depth that starts a worker when none is idle
+    uint64_t grow_wait_ns;          // Queueing delay that starts a worker, 0 for none
+    uint64_t keep_alive_ns;         // Idle time after which a worker above min_threads retires
+    void* (*worker_init)(size_t, void *);
+    void (*worker_teardown)(void *, void *);
+    void* worker_arg;
+    YATPoolScheduler scheduler;
+    YATPoolQueueType queue_type;
+    YATPoolOverflow overflow;
+    int sleepers, spinners, slot_waiters, future_waiters, quiesce_waiters;
+    YATPoolParking parking;
+    Worker** idle_workers;          // Workers parked on their futex, most recent last
+    size_t num_idle;
+    size_t spin_count, yield_count;
+    TaskQueue** task_queues;        // One queue per priority lane of every node
+    MPMCQueue** mpmc_queues;
+    size_t num_lanes;
+    size_t* lane_skips;             // Times each lane was passed over while holding tasks
+    size_t* lane_max_depth;
+    YATPoolAffinity affinity;
+    size_t num_nodes, next_node;
+    cpu_set_t* node_cpus;           // CPUs of every node, or the CPUs workers are pinned to
+    int* node_ids;                  // NUMA node id of every node, in increasing order; NULL unless NUMA
     void** retvalarr;
-    bool done;
-    int completed, total_tasks;
+    bool done, shutdown, streaming;
+    int next_result, completed, total_tasks;
+    size_t in_flight;
+    ProducerSlot* producers;        // PRODUCER_SLOTS submission counters for threads outside the pool
+    uint64_t slot_wait_ns;          // Time producers spent waiting for a queue slot, under the mutex
+    size_t tasks_blocked, tasks_rejected, tasks_caller_ran, tasks_dropped;
+    size_t tasks_cancelled;
+    Task* free_tasks;
+    SlabChunk* slab_chunks;
+    size_t slab_hits, slab_misses;
     pthread_attr_t attr;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_queue, cond_slot_available, cond_done;
+    pthread_mutex_t mutex, slab_mutex, idle_mutex, resize_mutex;
+    pthread_cond_t cond_queue, cond_slot_available, cond_done, cond_future;
+#ifdef YATPOOL_TRACE
+    uint64_t trace_start_ns;        // Origin of the timestamps of a dumped trace
+#endif
 } YATPool;
 
+/// Worker of the pool running on the current thread, if any
+static __thread Worker* _yatpool_current_worker = NULL;
+
+/// Submission counter slot of the current thread in the pools it is not a
+/// worker of, assigned round robin on its first submission
+static __thread size_t _yatpool_producer_slot = SIZE_MAX;
+static size_t _yatpool_next_producer_slot = 0;
+
 /// Task struct definition
 typedef struct task {
     void* (*taskfunc)(void *);
     void* arg;
     void (*argdestructor)(void *);
+    YATPool* slab_pool;         // Pool whose slab owns the task, NULL if malloc'd
+    struct task* next_free;     // Link in a slab free list
+    bool internal;              // Run on behalf of the pool, not counted in the batch
+    struct future* future;      // Receives the result instead of the batch, if set
+    struct yatpool_group* group;  // Group the task was put in, if any; its result is discarded
+    struct cancel_token* cancel;  // Token that cancels the task, if any; holds a reference
+    size_t priority;            // Priority lane, 0 being the highest
+    int node;                   // Node whose queue the task goes to, -1 for any
+    int unmet_deps;             // Unfinished dependencies, plus one until the task is submitted
+    struct task** successors;   // Tasks that depend on this one
+    size_t num_successors, max_successors;
+    uint64_t queued_at;         // When the task was queued, if the pool grows on queueing delay
+#ifdef YATPOOL_TRACE
+    const char* label;          // Name of the task in a dumped trace
+    uint64_t submit_ns;
+#endif
+    unsigned char inline_arg[YATPOOL_TASK_INLINE_SIZE] __attribute__((aligned(16)));
 } Task;
 
+/// Future struct definition. The submitter and the task each hold a
+/// reference; the last one to let go frees it.
+typedef struct future {
+    YATPool* pool;
+    void* result;
+    bool done;
+    int refs;
+} Future;
+
+/// Task group struct definition. Tasks put in a group can be waited for
+/// apart from the rest of the pool.
+typedef struct yatpool_group {
+    YATPool* pool;
+    size_t pending;             // Tasks put in the group that have not finished
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_done;
+} YATPoolGroup;
+
+/// Cancellation token struct definition. The creator and every task it is
+/// set on hold a reference; the last one to let go frees it.
+typedef struct cancel_token {
+    bool cancelled;
+    int refs;
+} CancelToken;
+
+/// Cancellation token of the task running on the current thread, if any
+static __thread CancelToken* _yatpool_current_token = NULL;
+
 /// Initialize a Task object
 void task_init(Task **task, void *(*taskfunc)(void *), void *arg, void (*argdestructor)(void *)) {
     if (task==NULL) {
@@ -171,198 +717,2337 @@ void task_init(Task **task, void *(*taskfunc)(void *), void *arg, void (*argdest
     (*task)->taskfunc = taskfunc;
     (*task)->arg = arg;
     (*task)->argdestructor = argdestructor;
+    (*task)->slab_pool = NULL;
+    (*task)->next_free = NULL;
+    (*task)->internal = false;
+    (*task)->future = NULL;
+    (*task)->group = NULL;
+    (*task)->cancel = NULL;
+    (*task)->priority = 0;
+    (*task)->node = -1;
+    (*task)->unmet_deps = 1;
+    (*task)->successors = NULL;
+    (*task)->num_successors = 0;
+    (*task)->max_successors = 0;
+    TRACE_TASK_INIT(*task);
     return;
 }
 
-/// Execute a task
-void* _yatpool_execute(YATPool* pool, Task* task) {
+/// Copy an argument of the given size into a task. Small arguments are
+/// stored inside the task itself, larger ones in a heap copy that is freed
+/// with the task.
+void _task_copy_arg(Task* task, const void* arg, size_t arg_size) {
+    if (arg_size <= YATPOOL_TASK_INLINE_SIZE) {
+        if (arg_size > 0)
+            memcpy(task->inline_arg, arg, arg_size);
+        task->arg = task->inline_arg;
+        task->argdestructor = NULL;
+    } else {
+        task->arg = malloc(arg_size);
+        memcpy(task->arg, arg, arg_size);
+        task->argdestructor = &free;
+    }
+}
+
+/// Initialize a Task object with a copy of its argument
+void task_init_inline(Task** task, void* (*taskfunc)(void *), const void* arg, size_t arg_size) {
     if (task==NULL) {
-        ERR("task pointer is null.");
-        return NULL;
+        ERR("Task pointer is null.");
+        return;
     }
-    if (pool==NULL) {
-        ERR("yatpool pointer is null.");
-        return NULL;
+    if (arg==NULL && arg_size>0) {
+        ERR("arg cannot be null.");
+        return;
+    }
+    *task = NULL;
+    task_init(task, taskfunc, NULL, NULL);
+    if (*task!=NULL)
+        _task_copy_arg(*task, arg, arg_size);
+}
+
+/// Set the priority of a task, 0 being the highest. Priorities beyond the
+/// lowest lane of the pool fall into that lane.
+void task_set_priority(Task* task, size_t priority) {
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
     }
+    task->priority = priority;
+}
 
-    // Execute task
-    void* result = task->taskfunc(task->arg);
+/// Hint that a task should run on a NUMA node of a pool created with
+/// YATPOOL_AFFINITY_NUMA, given by its id in /sys/devices/system/node: it
+/// goes to the queue of that node, which the workers of the node serve
+/// before the queues of other nodes. Without a hint, or with the id of a
+/// node the pool does not use, a task goes to the node of the worker
+/// submitting it, if any.
+void task_set_node(Task* task, int node) {
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
+    }
+    task->node = node;
+}
 
-    // Check if done
-    pthread_mutex_lock(&pool->mutex);
-    pool->retvalarr[pool->completed] = result;
-    pool->completed++;
-    if (pool->completed>=pool->total_tasks) {
-        pool->done = true;
-        pthread_cond_broadcast(&pool->cond_done);
+/// Name a task in the traces dumped by yatpool_trace_dump. The label is not
+/// copied and must stay valid until the trace is dumped. Does nothing
+/// unless the library is built with YATPOOL_TRACE.
+void task_set_label(Task* task, const char* label) {
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
     }
-    pthread_mutex_unlock(&pool->mutex);
+#ifdef YATPOOL_TRACE
+    task->label = label;
+#else
+    (void)label;
+#endif
+}
+
+void _cancel_token_release(CancelToken* token);
+
+/// Set the token that cancels a task. A task whose token is cancelled before
+/// it starts is discarded, and one already running can check its token with
+/// yatpool_task_cancelled. The task holds a reference to the token until it
+/// is destroyed.
+void task_set_cancel_token(Task* task, CancelToken* token) {
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
+    }
+    if (token!=NULL)
+        __atomic_add_fetch(&token->refs, 1, __ATOMIC_RELAXED);
+    if (task->cancel!=NULL)
+        _cancel_token_release(task->cancel);
+    task->cancel = token;
+}
+
+/// Make a task wait for another one to finish before it runs. Both tasks
+/// must be for the same pool, and the dependency must be declared before
+/// either of them is submitted. The task is queued once it has been
+/// submitted and all its dependencies have finished. Dependencies must not
+/// form a cycle.
+void task_depends_on(Task* task, Task* dependency) {
+    if (task==NULL || dependency==NULL) {
+        ERR("Task pointer is null.");
+        return;
+    }
+    if (task==dependency) {
+        ERR("a task cannot depend on itself.");
+        return;
+    }
+    if (dependency->num_successors == dependency->max_successors) {
+        dependency->max_successors = dependency->max_successors == 0? 4: 2 * dependency->max_successors;
+        dependency->successors = (Task**)realloc(dependency->successors,
+                                                 dependency->max_successors * sizeof(Task*));
+    }
+    dependency->successors[dependency->num_successors++] = task;
+    task->unmet_deps++;
+}
 
-    // Destroy task
+void _yatpool_slab_free(YATPool* pool, Task* task);
+
+/// Destroy a task that will not run, such as one refused by yatpool_try_put
+/// or yatpool_put_timed: run its argument destructor, release its
+/// cancellation token and its list of dependents, and free it or return it
+/// to the slab it came from. Tasks that depend on it are not released, and
+/// it must not be waiting for dependencies of its own.
+void task_destroy(Task* task) {
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
+    }
     if (task->argdestructor!=NULL)
         task->argdestructor(task->arg);
-    free(task);
-
-    return result;
+    if (task->cancel!=NULL)
+        _cancel_token_release(task->cancel);
+    free(task->successors);
+    if (task->slab_pool!=NULL)
+        _yatpool_slab_free(task->slab_pool, task);
+    else
+        free(task);
 }
 
-/// Start a task thread
-void* _yatpool_start_thread(void* arg) {
-    YATPool* pool = (YATPool*)arg;
+/// Allocate a new chunk of tasks for the slab of a pool and return them as
+/// a free list. Called with the slab mutex held.
+Task* _yatpool_slab_grow(YATPool* pool) {
+    SlabChunk* chunk = (SlabChunk*)malloc(sizeof(SlabChunk));
+    chunk->tasks = (Task*)malloc(SLAB_CHUNK_SIZE * sizeof(Task));
+    chunk->next = pool->slab_chunks;
+    pool->slab_chunks = chunk;
 
-    while (true) {
-        Task* task;
+    for (size_t i = 0; i < SLAB_CHUNK_SIZE; ++i) {
+        chunk->tasks[i].slab_pool = pool;
+        chunk->tasks[i].next_free = (i + 1 < SLAB_CHUNK_SIZE)? &chunk->tasks[i + 1]: NULL;
+    }
+    return &chunk->tasks[0];
+}
 
-        pthread_mutex_lock(&pool->mutex);
+/// Take a task object from the slab of a pool. Workers of the pool use their
+/// own cache and only lock the pool slab to refill it; other threads take
+/// objects from the pool slab directly.
+Task* _yatpool_slab_alloc(YATPool* pool) {
+    Worker* worker = _yatpool_current_worker;
+    Task* task;
 
-        // Wait until a slot is available in the queue
-        while (taskqueue_empty(pool->task_queue) && !pool->done) {
-            pthread_cond_wait(&pool->cond_queue, &pool->mutex);
+    if (worker != NULL && worker->pool == pool) {
+        if (worker->free_tasks == NULL) {
+            // Refill the cache with up to a chunk of free tasks of the pool,
+            // or with a new chunk
+            pthread_mutex_lock(&pool->slab_mutex);
+            if (pool->free_tasks != NULL) {
+                Task* last = pool->free_tasks;
+                size_t n = 1;
+                while (n < SLAB_CHUNK_SIZE && last->next_free != NULL) {
+                    last = last->next_free;
+                    n++;
+                }
+                worker->free_tasks = pool->free_tasks;
+                pool->free_tasks = last->next_free;
+                last->next_free = NULL;
+                worker->num_free_tasks = n;
+                __atomic_store_n(&worker->slab_hits, worker->slab_hits + 1, __ATOMIC_RELAXED);
+            } else {
+                worker->free_tasks = _yatpool_slab_grow(pool);
+                worker->num_free_tasks = SLAB_CHUNK_SIZE;
+                __atomic_store_n(&worker->slab_misses, worker->slab_misses + 1, __ATOMIC_RELAXED);
+            }
+            pthread_mutex_unlock(&pool->slab_mutex);
+        } else {
+            __atomic_store_n(&worker->slab_hits, worker->slab_hits + 1, __ATOMIC_RELAXED);
         }
-        if (pool->done) {
-            pthread_mutex_unlock(&pool->mutex);
-            break;
-        }
-        task = (Task *)taskqueue_pop(pool->task_queue);
+        task = worker->free_tasks;
+        worker->free_tasks = task->next_free;
+        worker->num_free_tasks--;
+        return task;
+    }
 
-        if (taskqueue_empty(pool->task_queue)) {
-            pthread_cond_signal(&pool->cond_slot_available);
-        }
-        pthread_mutex_unlock(&pool->mutex);
-        _yatpool_execute(pool, task);
+    pthread_mutex_lock(&pool->slab_mutex);
+    if (pool->free_tasks != NULL) {
+        pool->slab_hits++;
+    } else {
+        pool->free_tasks = _yatpool_slab_grow(pool);
+        pool->slab_misses++;
     }
-    return NULL;
+    task = pool->free_tasks;
+    pool->free_tasks = task->next_free;
+    pthread_mutex_unlock(&pool->slab_mutex);
+    return task;
 }
 
-/// Create threads
-void _yatpool_create_threads(YATPool* pool) {
-    if (pool==NULL) {
-        ERR("yatpool pointer is null.");
+/// Return a task object to the slab of its pool
+void _yatpool_slab_free(YATPool* pool, Task* task) {
+    Worker* worker = _yatpool_current_worker;
+
+    if (worker != NULL && worker->pool == pool) {
+        task->next_free = worker->free_tasks;
+        worker->free_tasks = task;
+        worker->num_free_tasks++;
+        if (worker->num_free_tasks < SLAB_CACHE_SIZE)
+            return;
+
+        // Cache is full: hand the older half back to the pool slab
+        Task* last = worker->free_tasks;
+        for (size_t i = 1; i < SLAB_CACHE_SIZE / 2; ++i)
+            last = last->next_free;
+        Task* surplus = last->next_free;
+        last->next_free = NULL;
+        worker->num_free_tasks = SLAB_CACHE_SIZE / 2;
+
+        Task* tail = surplus;
+        while (tail->next_free != NULL)
+            tail = tail->next_free;
+        pthread_mutex_lock(&pool->slab_mutex);
+        tail->next_free = pool->free_tasks;
+        pool->free_tasks = surplus;
+        pthread_mutex_unlock(&pool->slab_mutex);
         return;
     }
 
-    for (size_t i = 0; i < pool->pool_size; ++i) {
-        if (pthread_create(&pool->threads[i], &pool->attr, &_yatpool_start_thread, pool) != 0)
-            ERR_AND_EXIT("Could not create thread");
-    }
+    pthread_mutex_lock(&pool->slab_mutex);
+    task->next_free = pool->free_tasks;
+    pool->free_tasks = task;
+    pthread_mutex_unlock(&pool->slab_mutex);
 }
 
-/// Initialize a thread pool.
-void yatpool_init(YATPool** pool, size_t num_threads, size_t num_tasks) {
-    if (num_threads==0) ERR_AND_EXIT("num_threads cannot be zero.");
-    if (num_tasks==0) ERR_AND_EXIT("num_tasks cannot be zero.");
-
+/// Initialize a Task object allocated from the task slab of a pool. The task
+/// must be submitted to the same pool, which recycles it after execution.
+void yatpool_task_init(YATPool* pool, Task** task, void* (*taskfunc)(void *), void* arg, void (*argdestructor)(void *)) {
     if (pool==NULL) {
         ERR("yatpool pointer is null.");
         return;
     }
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
+    }
+    if (taskfunc==NULL) {
+        ERR("taskfunc cannot be null.");
+        return;
+    }
+    *task = _yatpool_slab_alloc(pool);
+    (*task)->taskfunc = taskfunc;
+    (*task)->arg = arg;
+    (*task)->argdestructor = argdestructor;
+    (*task)->next_free = NULL;
+    (*task)->internal = false;
+    (*task)->future = NULL;
+    (*task)->group = NULL;
+    (*task)->cancel = NULL;
+    (*task)->priority = 0;
+    (*task)->node = -1;
+    (*task)->unmet_deps = 1;
+    (*task)->successors = NULL;
+    (*task)->num_successors = 0;
+    (*task)->max_successors = 0;
+    TRACE_TASK_INIT(*task);
+}
 
-    *pool = (YATPool*)malloc(sizeof(YATPool));
+/// Initialize a Task object allocated from the task slab of a pool, with a
+/// copy of its argument
+void yatpool_task_init_inline(YATPool* pool, Task** task, void* (*taskfunc)(void *), const void* arg, size_t arg_size) {
+    if (task==NULL) {
+        ERR("Task pointer is null.");
+        return;
+    }
+    if (arg==NULL && arg_size>0) {
+        ERR("arg cannot be null.");
+        return;
+    }
+    *task = NULL;
+    yatpool_task_init(pool, task, taskfunc, NULL, NULL);
+    if (*task!=NULL)
+        _task_copy_arg(*task, arg, arg_size);
+}
 
-    (*pool)->threads = (pthread_t*)calloc(num_threads, sizeof(YATPool));
-    
-    taskqueue_init(&(*pool)->task_queue, MAX_QUEUE_SIZE);
+/// Release a reference to a future
+void _future_release(Future* future) {
+    if (__atomic_sub_fetch(&future->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(future);
+}
 
-    (*pool)->retvalarr = (void**)calloc(num_tasks, sizeof(void*));
-    
-    pthread_attr_init(&(*pool)->attr);
-    pthread_cond_init(&(*pool)->cond_queue, NULL);
-    pthread_cond_init(&(*pool)->cond_slot_available, NULL);
-    pthread_cond_init(&(*pool)->cond_done, NULL);
-    pthread_mutex_init(&(*pool)->mutex, NULL);
+/// Store the result of a task in its future and wake up its waiters, if
+/// any. A waiter registers before checking the future, so that it either
+/// sees the result or is seen here.
+void _future_complete(Future* future, void* result) {
+    YATPool* pool = future->pool;
 
-    (*pool)->total_tasks = num_tasks;
-    (*pool)->pool_size = num_threads;
-    (*pool)->done = false;
-    (*pool)->completed = 0;
+    future->result = result;
+    __atomic_store_n(&future->done, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->future_waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->cond_future);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    _future_release(future);
+}
 
-    _yatpool_create_threads(*pool);
-};
+/// Check whether the task of a future has completed, without blocking
+bool future_poll(Future* future) {
+    if (future==NULL) {
+        ERR("future pointer is null.");
+        return false;
+    }
+    return __atomic_load_n(&future->done, __ATOMIC_ACQUIRE);
+}
 
-/// Submit a task to a threadpool
-void yatpool_put(YATPool* pool, Task* task) {
-    if (task==NULL) {
-        ERR("task pointer is null.");
+/// Wait until the task of a future has completed. Must not be called from a
+/// task running on the same pool, as it blocks the worker.
+void future_wait(Future* future) {
+    if (future==NULL) {
+        ERR("future pointer is null.");
         return;
     }
-    if (pool==NULL) {
-        ERR("yatpool pointer is null.");
+    if (__atomic_load_n(&future->done, __ATOMIC_ACQUIRE))
         return;
-    }
 
+    YATPool* pool = future->pool;
     pthread_mutex_lock(&pool->mutex);
-    
-    // If the queue is full, wait
-    while (taskqueue_full(pool->task_queue)) {
-        pthread_cond_wait(&pool->cond_slot_available, &pool->mutex);
+    __atomic_add_fetch(&pool->future_waiters, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&future->done, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&pool->cond_future, &pool->mutex);
     }
-
-    // Once queue has space, add task to queue
-    taskqueue_put(pool->task_queue, (void *)task);
+    __atomic_sub_fetch(&pool->future_waiters, 1, __ATOMIC_SEQ_CST);
     pthread_mutex_unlock(&pool->mutex);
-    pthread_cond_signal(&pool->cond_queue);
-    
-    return;
 }
 
-/// Wait until all tasks are completed
-void** yatpool_wait(YATPool* pool) {
-    if (pool==NULL) {
-        ERR("yatpool pointer is null.");
+/// Wait until the task of a future has completed and get its result. The
+/// result belongs to the caller.
+void* future_get(Future* future) {
+    if (future==NULL) {
+        ERR("future pointer is null.");
         return NULL;
     }
+    future_wait(future);
+    return future->result;
+}
 
-    pthread_mutex_lock(&pool->mutex);
-
-    while (!pool->done) {
-        pthread_cond_wait(&pool->cond_done, &pool->mutex);
+/// Destroy a future. Its task may still be pending; its result is then
+/// lost.
+void future_destroy(Future* future) {
+    if (future==NULL) {
+        ERR("future pointer is null.");
+        return;
     }
-    pthread_cond_broadcast(&pool->cond_queue);
+    _future_release(future);
+}
+
+/// Initialize a cancellation token, which can be set on any number of tasks
+void cancel_token_init(CancelToken** token) {
+    if (token==NULL) {
+        ERR("token pointer is null.");
+        return;
+    }
+    *token = (CancelToken*)malloc(sizeof(CancelToken));
+    if (*token==NULL) {
+        ERR_AND_EXIT("Failed to allocate memory for the cancellation token.");
+    }
+    (*token)->cancelled = false;
+    (*token)->refs = 1;
+}
+
+/// Cancel the tasks a token is set on. Those not started yet are discarded
+/// when they are dequeued; those running see it in yatpool_task_cancelled.
+void cancel_token_cancel(CancelToken* token) {
+    if (token==NULL) {
+        ERR("token pointer is null.");
+        return;
+    }
+    __atomic_store_n(&token->cancelled, true, __ATOMIC_RELEASE);
+}
+
+/// Check whether a token has been cancelled
+bool cancel_token_cancelled(CancelToken* token) {
+    if (token==NULL) {
+        ERR("token pointer is null.");
+        return false;
+    }
+    return __atomic_load_n(&token->cancelled, __ATOMIC_ACQUIRE);
+}
+
+/// Release a reference to a cancellation token
+void _cancel_token_release(CancelToken* token) {
+    if (__atomic_sub_fetch(&token->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(token);
+}
+
+/// Destroy a cancellation token. Tasks it is set on may still be pending;
+/// they keep it alive until they are done.
+void cancel_token_destroy(CancelToken* token) {
+    if (token==NULL) {
+        ERR("token pointer is null.");
+        return;
+    }
+    _cancel_token_release(token);
+}
+
+/// Count a task of a group as finished. The last pending task wakes up the
+/// waiters with the mutex held, and a waiter that saw the count reach zero
+/// takes the mutex before returning, so the group cannot be freed under
+/// the task signalling it.
+void _yatpool_group_finish(YATPoolGroup* group) {
+    size_t pending = __atomic_load_n(&group->pending, __ATOMIC_RELAXED);
+    while (pending > 1) {
+        if (__atomic_compare_exchange_n(&group->pending, &pending, pending - 1, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+    }
+    pthread_mutex_lock(&group->mutex);
+    __atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+    pthread_cond_broadcast(&group->cond_done);
+    pthread_mutex_unlock(&group->mutex);
+}
+
+void _yatpool_enqueue_batch(YATPool* pool, Task** tasks, size_t num_tasks);
+
+/// Release the successors of a finished task and queue those that are
+/// ready. On a work-stealing worker they go to its own deque, so they are
+/// likely to run on the core that produced their input.
+void _yatpool_release_successors(YATPool* pool, Task* task) {
+    size_t num_ready = 0;
+    for (size_t i = 0; i < task->num_successors; ++i) {
+        Task* successor = task->successors[i];
+        if (__atomic_sub_fetch(&successor->unmet_deps, 1, __ATOMIC_ACQ_REL) == 0)
+            task->successors[num_ready++] = successor;
+    }
+    if (num_ready > 0)
+        _yatpool_enqueue_batch(pool, task->successors, num_ready);
+    free(task->successors);
+    task->successors = NULL;
+    task->num_successors = 0;
+    task->max_successors = 0;
+}
+
+/// Count a task as no longer in flight, and wake up yatpool_quiesce if it
+/// was the last one. A waiter registers before checking the count, so that
+/// it either sees the count drop or is seen here.
+void _yatpool_drained(YATPool* pool) {
+    if (__atomic_sub_fetch(&pool->in_flight, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&pool->quiesce_waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->cond_done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/// Complete a task that has run, or was discarded, with the given result:
+/// release its successors, deliver the result and destroy the task
+void _yatpool_complete(YATPool* pool, Task* task, void* result) {
+    bool internal = task->internal;
+    YATPoolGroup* group = task->group;
+
+    // Queue the successors whose last dependency this was
+    if (task->num_successors > 0)
+        _yatpool_release_successors(pool, task);
+
+    // Store the result, then count the task as completed. The mutex is only
+    // needed by the last task of the batch, to wake up yatpool_wait. The
+    // batch size is read first, as yatpool_reset may change it as soon as
+    // the last task has been counted. Tasks with a future only complete
+    // their future, tasks of a group are not part of the batch, and a
+    // streaming pool has no batch to store results in.
+    if (task->future != NULL) {
+        _future_complete(task->future, result);
+    } else if (group != NULL) {
+        free(result);
+    } else if (pool->streaming) {
+        if (!task->internal)
+            free(result);
+    } else if (!task->internal) {
+        int total_tasks = pool->total_tasks;
+        int slot = __atomic_fetch_add(&pool->next_result, 1, __ATOMIC_RELAXED);
+        if (slot<total_tasks)
+            pool->retvalarr[slot] = result;
+        int completed = __atomic_add_fetch(&pool->completed, 1, __ATOMIC_ACQ_REL);
+        if (completed==total_tasks) {
+            pthread_mutex_lock(&pool->mutex);
+            pool->done = true;
+            pthread_cond_broadcast(&pool->cond_done);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+
+    task_destroy(task);
+
+    if (group != NULL)
+        _yatpool_group_finish(group);
+    if (!internal)
+        _yatpool_drained(pool);
+}
+
+/// Execute a task
+void* _yatpool_execute(YATPool* pool, Task* task) {
+    if (task==NULL) {
+        ERR("task pointer is null.");
+        return NULL;
+    }
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return NULL;
+    }
+
+    // A cancelled task is dropped as it is dequeued, which all dequeued
+    // tasks come through
+    if (task->cancel != NULL && __atomic_load_n(&task->cancel->cancelled, __ATOMIC_ACQUIRE)) {
+        if (!task->internal)
+            __atomic_add_fetch(&pool->tasks_cancelled, 1, __ATOMIC_RELAXED);
+        _yatpool_complete(pool, task, NULL);
+        return NULL;
+    }
+
+    // The token of a task that runs another one while it waits is put back
+    CancelToken* outer_token = _yatpool_current_token;
+    _yatpool_current_token = task->cancel;
+    void* result = task->taskfunc(task->arg);
+    _yatpool_current_token = outer_token;
+
+    _yatpool_complete(pool, task, result);
+    return result;
+}
+
+/// Discard a task without running it. It counts as completed with a NULL
+/// result, so its future, group or batch is not left waiting for it and its
+/// successors are released.
+void _yatpool_discard(YATPool* pool, Task* task) {
+    _yatpool_complete(pool, task, NULL);
+}
+
+/// Block on a futex word as long as it holds the expected value, for at
+/// most the given time if not NULL
+void _futex_wait(int* addr, int expected, const struct timespec* timeout) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+/// Get the time of the monotonic clock in nanoseconds
+uint64_t _yatpool_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/// Wake up at most num_threads threads blocked on a futex word
+void _futex_wake(int* addr, int num_threads) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num_threads, NULL, NULL, 0);
+}
+
+/// Take up to num_workers workers off the idle list, most recently parked
+/// first, and wake each on its own futex. A worker taken off the list
+/// cannot be counted again by another wakeup, so exactly as many workers
+/// as asked for are woken.
+void _yatpool_unpark(YATPool* pool, size_t num_workers) {
+    pthread_mutex_lock(&pool->idle_mutex);
+    while (num_workers > 0 && pool->num_idle > 0) {
+        Worker* worker = pool->idle_workers[--pool->num_idle];
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&worker->parked, 0, __ATOMIC_SEQ_CST);
+        _futex_wake(&worker->parked, 1);
+        num_workers--;
+    }
+    pthread_mutex_unlock(&pool->idle_mutex);
+}
+
+/// Wake up as many parked workers as there are new tasks, at most all of
+/// them. Tasks that spinning workers will pick up need no wakeup. Called
+/// with the mutex held when workers park on the condition variable, and
+/// without it when they park on their futex.
+void _yatpool_wake(YATPool* pool, size_t num_tasks) {
+    // Without the mutex, the new tasks must be visible before the sleepers
+    // are counted
+    if (pool->parking == YATPOOL_PARK_FUTEX)
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    size_t spinners = __atomic_load_n(&pool->spinners, __ATOMIC_SEQ_CST);
+    int sleepers = __atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST);
+    if (num_tasks <= spinners || sleepers == 0)
+        return;
+    num_tasks -= spinners;
+
+    if (pool->parking == YATPOOL_PARK_FUTEX) {
+        _yatpool_unpark(pool, num_tasks);
+        return;
+    }
+    if (num_tasks >= (size_t)sleepers) {
+        pthread_cond_broadcast(&pool->cond_queue);
+        return;
+    }
+    for (size_t i = 0; i < num_tasks; ++i)
+        pthread_cond_signal(&pool->cond_queue);
+}
+
+/// Wake up parked workers, if any, after tasks were made available without
+/// holding the mutex.
+void _yatpool_notify(YATPool* pool, size_t num_tasks) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (num_tasks > (size_t)__atomic_load_n(&pool->spinners, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        if (pool->parking == YATPOOL_PARK_FUTEX) {
+            _yatpool_wake(pool, num_tasks);
+            return;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        _yatpool_wake(pool, num_tasks);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/// Wake up parked workers for tasks queued under the mutex, which is held.
+/// Workers parked on their futex are woken with the mutex released for the
+/// time, so that they do not block on it as soon as they wake up.
+void _yatpool_wake_queued(YATPool* pool, size_t num_tasks) {
+    if (pool->parking != YATPOOL_PARK_FUTEX) {
+        _yatpool_wake(pool, num_tasks);
+        return;
+    }
+    if (num_tasks == 0)
+        return;
+    pthread_mutex_unlock(&pool->mutex);
+    _yatpool_notify(pool, num_tasks);
+    pthread_mutex_lock(&pool->mutex);
+}
+
+/// Get the number of tasks in a queue of the pool, given as node *
+/// num_lanes + lane. Called with the mutex held for the locked queue.
+size_t _yatpool_lane_size(YATPool* pool, size_t queue) {
+    if (pool->queue_type == YATPOOL_QUEUE_LOCK_FREE)
+        return mpmcqueue_size(pool->mpmc_queues[queue]);
+    return taskqueue_size(pool->task_queues[queue]);
+}
+
+/// Choose the priority lane of a node to serve next: the highest priority
+/// lane holding tasks, unless a lower one has been passed over
+/// PRIORITY_AGING_LIMIT times, so that no lane starves. Returns num_lanes
+/// if all lanes are empty. Called with the mutex held for the locked
+/// queue; for the lock-free queue, the counts are only approximate.
+size_t _yatpool_pick_lane(YATPool* pool, size_t node) {
+    size_t base = node * pool->num_lanes;
+    if (pool->num_lanes == 1)
+        return _yatpool_lane_size(pool, base) > 0? 0: 1;
+
+    size_t chosen = pool->num_lanes;
+    for (size_t lane = 0; lane < pool->num_lanes; ++lane) {
+        if (_yatpool_lane_size(pool, base + lane) == 0)
+            continue;
+        if (chosen == pool->num_lanes) {
+            chosen = lane;
+        } else if (__atomic_load_n(&pool->lane_skips[base + lane], __ATOMIC_RELAXED) >= PRIORITY_AGING_LIMIT) {
+            chosen = lane;
+            break;
+        }
+    }
+    if (chosen == pool->num_lanes)
+        return chosen;
+
+    for (size_t lane = 0; lane < pool->num_lanes; ++lane) {
+        if (lane == chosen)
+            __atomic_store_n(&pool->lane_skips[base + lane], 0, __ATOMIC_RELAXED);
+        else if (_yatpool_lane_size(pool, base + lane) > 0)
+            __atomic_add_fetch(&pool->lane_skips[base + lane], 1, __ATOMIC_RELAXED);
+    }
+    return chosen;
+}
+
+/// Pop a task from the queue of a node
+Task* _yatpool_pop_node(YATPool* pool, size_t node) {
+    size_t base = node * pool->num_lanes;
+    Task* task;
+    size_t lane;
+
+    if (pool->queue_type == YATPOOL_QUEUE_LOCK_FREE) {
+        lane = _yatpool_pick_lane(pool, node);
+        if (lane == pool->num_lanes)
+            return NULL;
+        task = (Task *)mpmcqueue_pop(pool->mpmc_queues[base + lane]);
+        if (task == NULL) {
+            // The lane was drained by another worker: take whatever is left
+            for (lane = 0; lane < pool->num_lanes; ++lane) {
+                if ((task = (Task *)mpmcqueue_pop(pool->mpmc_queues[base + lane])) != NULL)
+                    break;
+            }
+            if (task == NULL)
+                return NULL;
+        }
+
+        // Blocked producers are woken once the lane is down to half its
+        // length, rather than for every freed slot
+        MPMCQueue* queue = pool->mpmc_queues[base + lane];
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pool->slot_waiters, __ATOMIC_SEQ_CST) > 0 &&
+            mpmcqueue_size(queue) <= queue->length / 2) {
+            pthread_mutex_lock(&pool->mutex);
+            pthread_cond_broadcast(&pool->cond_slot_available);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+        return task;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    lane = _yatpool_pick_lane(pool, node);
+    task = NULL;
+    if (lane < pool->num_lanes) {
+        TaskQueue* queue = pool->task_queues[base + lane];
+        task = (Task *)taskqueue_pop(queue);
+        if (taskqueue_empty(queue)) {
+            // Producers may be waiting for other queues, so all are woken
+            // when there are several
+            if (pool->num_nodes * pool->num_lanes == 1)
+                pthread_cond_signal(&pool->cond_slot_available);
+            else
+                pthread_cond_broadcast(&pool->cond_slot_available);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return task;
+}
+
+/// Pop a task from the shared queues for a worker: the queue of its own
+/// node first, then those of the other nodes
+Task* _yatpool_pop_queue(Worker* worker) {
+    YATPool* pool = worker->pool;
+    for (size_t i = 0; i < pool->num_nodes; ++i) {
+        Task* task = _yatpool_pop_node(pool, (worker->node + i) % pool->num_nodes);
+        if (task != NULL)
+            return task;
+    }
+    return NULL;
+}
+
+/// Check whether the shared queues hold a task. The answer for the lock-free
+/// queue may be stale by the time the caller acts on it.
+bool _yatpool_queue_empty(YATPool* pool) {
+    for (size_t queue = 0; queue < pool->num_nodes * pool->num_lanes; ++queue) {
+        if (_yatpool_lane_size(pool, queue) > 0)
+            return false;
+    }
+    return true;
+}
+
+/// Try to steal a task from the other workers, starting at a random victim.
+/// Workers of the same node are tried before those of other nodes.
+Task* _yatpool_steal(Worker* worker) {
+    YATPool* pool = worker->pool;
+    if (pool->max_threads < 2)
+        return NULL;
+
+    size_t start = rand_r(&worker->seed) % pool->max_threads;
+    for (size_t pass = 0; pass < (pool->num_nodes > 1? 2: 1); ++pass) {
+        for (size_t i = 0; i < pool->max_threads; ++i) {
+            Worker* victim = &pool->workers[(start + i) % pool->max_threads];
+            if (victim == worker || (pool->num_nodes > 1 && (victim->node == worker->node) != (pass == 0)))
+                continue;
+            Task* task = (Task *)taskdeque_steal(victim->deque);
+            if (task != NULL) {
+                __atomic_store_n(&worker->steals, worker->steals + 1, __ATOMIC_RELAXED);
+                return task;
+            }
+        }
+    }
+    return NULL;
+}
+
+/// Check whether any worker deque holds a task
+bool _yatpool_deques_empty(YATPool* pool) {
+    for (size_t i = 0; i < pool->max_threads; ++i) {
+        if (!taskdeque_empty(pool->workers[i].deque))
+            return false;
+    }
+    return true;
+}
+
+/// Check whether there is work a worker could take
+bool _yatpool_has_work(Worker* worker) {
+    return !_yatpool_queue_empty(worker->pool) ||
+           (worker->deque != NULL && !_yatpool_deques_empty(worker->pool));
+}
+
+/// Keep an idle worker awake for a while in case new work shows up soon:
+/// first spinning spin_count times, then yielding the CPU yield_count
+/// times, looking for work after each. The worker counts as a spinner
+/// meanwhile, so that producers leave new tasks to it instead of waking a
+/// parked worker; if it parks after all, it looks for work once more
+/// before sleeping. Returns true if work showed up.
+bool _yatpool_spin(Worker* worker) {
+    YATPool* pool = worker->pool;
+    size_t rounds = pool->spin_count + pool->yield_count;
+    if (rounds == 0)
+        return false;
+
+    __atomic_add_fetch(&pool->spinners, 1, __ATOMIC_SEQ_CST);
+    bool found = false;
+    for (size_t i = 0; i < rounds && !found; ++i) {
+        if (i < pool->spin_count)
+            CPU_RELAX();
+        else
+            sched_yield();
+        found = _yatpool_has_work(worker);
+    }
+    __atomic_sub_fetch(&pool->spinners, 1, __ATOMIC_SEQ_CST);
+    return found;
+}
+
+/// Let a worker retire from a pool that has more than min_threads workers.
+/// Returns false if the pool cannot shrink.
+bool _yatpool_retire(YATPool* pool) {
+    size_t size = __atomic_load_n(&pool->pool_size, __ATOMIC_RELAXED);
+    while (size > pool->min_threads) {
+        if (__atomic_compare_exchange_n(&pool->pool_size, &size, size - 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+/// Put an idle worker to sleep until new work may be available. The worker
+/// announces itself as a sleeper before looking for work a last time, so
+/// that a concurrent submission either is seen here or sees the sleeper and
+/// signals it. While the pool has more than min_threads workers, the worker
+/// only sleeps for the keep-alive time and then retires. Returns false once
+/// the pool is shut down and no work is left, or the worker retired.
+bool _yatpool_park(Worker* worker) {
+    YATPool* pool = worker->pool;
+    bool may_retire = __atomic_load_n(&pool->pool_size, __ATOMIC_RELAXED) > pool->min_threads;
+    bool timed_out = false;
+
+    // With a futex, the worker joins the idle list before looking for work
+    // and sleeps until a producer takes it off the list. The fence orders
+    // the count of sleepers before the relaxed loads of the queue sizes; it
+    // pairs with the fence producers issue between queueing a task and
+    // reading the sleepers, so that either the worker sees the task or the
+    // producer sees the worker.
+    if (pool->parking == YATPOOL_PARK_FUTEX) {
+        pthread_mutex_lock(&pool->idle_mutex);
+        pool->idle_workers[pool->num_idle++] = worker;
+        __atomic_store_n(&worker->parked, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->idle_mutex);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        bool has_work = _yatpool_has_work(worker);
+        bool keep_running = has_work || !__atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST);
+        if (!has_work && keep_running && !may_retire) {
+            while (__atomic_load_n(&worker->parked, __ATOMIC_SEQ_CST))
+                _futex_wait(&worker->parked, 1, NULL);
+            return true;
+        }
+        if (!has_work && keep_running) {
+            uint64_t deadline = _yatpool_now_ns() + pool->keep_alive_ns;
+            while (__atomic_load_n(&worker->parked, __ATOMIC_SEQ_CST)) {
+                uint64_t now = _yatpool_now_ns();
+                if (now >= deadline) {
+                    timed_out = true;
+                    break;
+                }
+                struct timespec timeout = {(time_t)((deadline - now) / 1000000000u),
+                                           (long)((deadline - now) % 1000000000u)};
+                _futex_wait(&worker->parked, 1, &timeout);
+            }
+            if (!timed_out)
+                return true;
+        }
+
+        // Not sleeping after all: leave the idle list, unless a producer
+        // has already taken the worker off it, in which case it must not
+        // retire either
+        pthread_mutex_lock(&pool->idle_mutex);
+        if (__atomic_load_n(&worker->parked, __ATOMIC_SEQ_CST)) {
+            size_t i = 0;
+            while (pool->idle_workers[i] != worker)
+                i++;
+            pool->idle_workers[i] = pool->idle_workers[--pool->num_idle];
+            __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&worker->parked, 0, __ATOMIC_SEQ_CST);
+        } else {
+            timed_out = false;
+        }
+        pthread_mutex_unlock(&pool->idle_mutex);
+        if (timed_out && _yatpool_retire(pool))
+            return false;
+        return keep_running;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+
+    bool has_work = _yatpool_has_work(worker);
+    bool keep_running = has_work || !pool->shutdown;
+    if (!has_work && keep_running && !may_retire) {
+        pthread_cond_wait(&pool->cond_queue, &pool->mutex);
+    } else if (!has_work && keep_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nsec = (uint64_t)deadline.tv_nsec + pool->keep_alive_ns;
+        deadline.tv_sec += (time_t)(nsec / 1000000000u);
+        deadline.tv_nsec = (long)(nsec % 1000000000u);
+        timed_out = pthread_cond_timedwait(&pool->cond_queue, &pool->mutex, &deadline) == ETIMEDOUT &&
+                    !_yatpool_has_work(worker);
+    }
+
+    __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->mutex);
+    if (timed_out && _yatpool_retire(pool))
+        return false;
+    return keep_running;
+}
+
+/// Find the next task for a worker: first its own deque (newest first), then
+/// the shared queue, then the other workers' deques (oldest first). Spins,
+/// then parks the worker when there is nothing to do. Returns NULL once the
+/// pool is shut down and no work is left, or the worker retired.
+Task* _yatpool_next_task(Worker* worker) {
+    while (true) {
+        Task* task;
+
+        if (worker->deque != NULL && (task = (Task *)taskdeque_take(worker->deque)) != NULL)
+            return task;
+        if ((task = _yatpool_pop_queue(worker)) != NULL)
+            return task;
+        if (worker->deque != NULL && (task = _yatpool_steal(worker)) != NULL)
+            return task;
+        if (_yatpool_spin(worker))
+            continue;
+        if (!_yatpool_park(worker))
+            return NULL;
+    }
+}
+
+void _yatpool_check_delay(YATPool* pool, Task* task);
+
+#ifdef YATPOOL_TRACE
+/// Record the lifecycle of a task run by a worker of a pool, or by a thread
+/// outside it if worker is NULL
+void _yatpool_trace_record(YATPool* pool, Worker* worker, TraceEvent* event, uint64_t end_ns) {
+    TraceBuffer* trace = worker != NULL? &worker->trace: &pool->callers.trace;
+    event->end_ns = end_ns;
+    if (worker == NULL)
+        pthread_mutex_lock(&pool->callers.trace_mutex);
+    size_t head = trace->head;
+    trace->events[head % TRACE_BUFFER_SIZE] = *event;
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+    if (worker == NULL)
+        pthread_mutex_unlock(&pool->callers.trace_mutex);
+}
+#endif
+
+/// Nesting depth of the tasks running on the current thread
+static __thread size_t _yatpool_run_depth = 0;
+
+/// Run a task taken off a queue at dequeue_ns, recording it in the
+/// statistics and the trace of the worker on the current thread, or in the
+/// record kept for threads outside the pool. The task is counted before it
+/// runs, so that the count is complete as soon as yatpool_quiesce or
+/// yatpool_wait returns. A task run inside another one, while that one
+/// waits, adds no busy time, as the time of the outer task covers it.
+/// Returns when the task ended.
+uint64_t _yatpool_run(YATPool* pool, Task* task, uint64_t dequeue_ns) {
+    Worker* worker = _yatpool_current_worker;
+    if (worker != NULL && worker->pool != pool)
+        worker = NULL;
+
+    if (pool->grow_wait_ns > 0)
+        _yatpool_check_delay(pool, task);
+    if (worker != NULL)
+        __atomic_store_n(&worker->tasks_executed, worker->tasks_executed + 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&pool->callers.tasks_executed, 1, __ATOMIC_RELAXED);
+    TRACE_BEGIN(event, task, dequeue_ns);
+
+    _yatpool_run_depth++;
+    _yatpool_execute(pool, task);
+    _yatpool_run_depth--;
+
+    uint64_t end = _yatpool_now_ns();
+    if (_yatpool_run_depth == 0) {
+        if (worker != NULL)
+            __atomic_store_n(&worker->busy_ns, worker->busy_ns + (end - dequeue_ns), __ATOMIC_RELAXED);
+        else
+            __atomic_add_fetch(&pool->callers.busy_ns, end - dequeue_ns, __ATOMIC_RELAXED);
+    }
+    TRACE_END(pool, worker, event, end);
+    return end;
+}
+
+/// Run one pending task of a pool on the current thread instead of
+/// blocking: from the deque of the current worker, the shared queues, or
+/// the deques of the workers. Returns false if there was none.
+bool _yatpool_help(YATPool* pool) {
+    Worker* worker = _yatpool_current_worker;
+    Task* task = NULL;
+
+    if (worker != NULL && worker->pool == pool) {
+        if (worker->deque != NULL)
+            task = (Task *)taskdeque_take(worker->deque);
+        if (task == NULL)
+            task = _yatpool_pop_queue(worker);
+        if (task == NULL && worker->deque != NULL)
+            task = _yatpool_steal(worker);
+    } else {
+        for (size_t node = 0; node < pool->num_nodes && task == NULL; ++node)
+            task = _yatpool_pop_node(pool, node);
+        for (size_t i = 0; i < pool->max_threads && task == NULL; ++i) {
+            if (pool->workers[i].deque != NULL)
+                task = (Task *)taskdeque_steal(pool->workers[i].deque);
+        }
+    }
+
+    if (task == NULL)
+        return false;
+    _yatpool_run(pool, task, _yatpool_now_ns());
+    return true;
+}
+
+/// Check whether the current thread is a worker of a pool, which must run
+/// tasks rather than sleep while it waits for other tasks, as it may be the
+/// one that would run them
+bool _yatpool_on_worker(YATPool* pool) {
+    Worker* worker = _yatpool_current_worker;
+    return worker != NULL && worker->pool == pool;
+}
+
+/// Start a task thread
+void* _yatpool_start_thread(void* arg) {
+    Worker* worker = (Worker*)arg;
+    YATPool* pool = worker->pool;
+
+    _yatpool_current_worker = worker;
+    if (pool->worker_init != NULL)
+        worker->ctx = pool->worker_init(worker->id, pool->worker_arg);
+
+    // Time spent finding a task counts as idle, time running it as busy
+    uint64_t now = _yatpool_now_ns();
+    while (true) {
+        Task* task = _yatpool_next_task(worker);
+        uint64_t found = _yatpool_now_ns();
+        __atomic_store_n(&worker->idle_ns, worker->idle_ns + (found - now), __ATOMIC_RELAXED);
+        if (task == NULL)
+            break;
+        now = _yatpool_run(pool, task, found);
+    }
+
+    if (pool->worker_teardown != NULL)
+        pool->worker_teardown(worker->ctx, pool->worker_arg);
+    worker->ctx = NULL;
+
+    // Hand the cached task objects back to the pool slab, as the slot may
+    // be reused by another thread
+    if (worker->free_tasks != NULL) {
+        Task* tail = worker->free_tasks;
+        while (tail->next_free != NULL)
+            tail = tail->next_free;
+        pthread_mutex_lock(&pool->slab_mutex);
+        tail->next_free = pool->free_tasks;
+        pool->free_tasks = worker->free_tasks;
+        pthread_mutex_unlock(&pool->slab_mutex);
+        worker->free_tasks = NULL;
+        worker->num_free_tasks = 0;
+    }
+
+    _yatpool_current_worker = NULL;
+    __atomic_store_n(&worker->state, WORKER_RETIRED, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/// Get the CPUs a worker is pinned to. Returns false if it may run on any.
+bool _yatpool_worker_cpus(YATPool* pool, Worker* worker, cpu_set_t* cpus) {
+    switch (pool->affinity) {
+    case YATPOOL_AFFINITY_NONE:
+        return false;
+    case YATPOOL_AFFINITY_CPU_SET:
+        *cpus = pool->node_cpus[0];
+        return true;
+    case YATPOOL_AFFINITY_PER_CORE: {
+        // The n-th allowed CPU, wrapping around if there are more workers
+        size_t n = worker->id % CPU_COUNT(&pool->node_cpus[0]);
+        CPU_ZERO(cpus);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &pool->node_cpus[0]) && n-- == 0) {
+                CPU_SET(cpu, cpus);
+                break;
+            }
+        }
+        return true;
+    }
+    case YATPOOL_AFFINITY_NUMA:
+        *cpus = pool->node_cpus[worker->node];
+        return true;
+    }
+    return false;
+}
+
+/// Start the thread of a worker slot
+void _yatpool_start_worker(YATPool* pool, Worker* worker) {
+    cpu_set_t cpus;
+    if (_yatpool_worker_cpus(pool, worker, &cpus) &&
+        pthread_attr_setaffinity_np(&pool->attr, sizeof(cpus), &cpus) != 0)
+        ERR_AND_EXIT("Could not set the CPU affinity of a thread");
+    __atomic_store_n(&worker->state, WORKER_RUNNING, __ATOMIC_RELAXED);
+    worker->parked = 0;
+    if (pthread_create(&pool->threads[worker->id], &pool->attr, &_yatpool_start_thread, worker) != 0)
+        ERR_AND_EXIT("Could not create thread");
+}
+
+/// Create threads
+void _yatpool_create_threads(YATPool* pool) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+
+    // Workers started here may retire and lower pool_size at once, so the
+    // initial count is taken before any of them starts
+    size_t num_threads = pool->pool_size;
+    for (size_t i = 0; i < pool->max_threads; ++i) {
+        Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->id = i;
+        worker->seed = (unsigned int)(i + 1);
+        worker->ctx = NULL;
+        worker->state = WORKER_UNUSED;
+        worker->deque = NULL;
+        worker->parked = 0;
+        worker->free_tasks = NULL;
+        worker->num_free_tasks = 0;
+        worker->slab_hits = 0;
+        worker->slab_misses = 0;
+        worker->tasks_executed = 0;
+        worker->tasks_submitted = 0;
+        worker->steals = 0;
+        worker->busy_ns = 0;
+        worker->idle_ns = 0;
+#ifdef YATPOOL_TRACE
+        worker->trace.events = (TraceEvent*)malloc(TRACE_BUFFER_SIZE * sizeof(TraceEvent));
+        worker->trace.head = 0;
+#endif
+        // The first workers are split into contiguous groups, one per node;
+        // the ones an elastic pool adds later go round the nodes
+        if (i < num_threads)
+            worker->node = i * pool->num_nodes / num_threads;
+        else
+            worker->node = i % pool->num_nodes;
+        if (pool->scheduler == YATPOOL_SCHED_WORK_STEALING)
+            taskdeque_init(&worker->deque);
+    }
+    for (size_t i = 0; i < num_threads; ++i)
+        _yatpool_start_worker(pool, &pool->workers[i]);
+}
+
+/// Add a worker to an elastic pool, unless it has max_threads workers
+/// already or is shutting down. The slot of a retired worker is reused once
+/// its thread has been joined.
+void _yatpool_grow(YATPool* pool) {
+    pthread_mutex_lock(&pool->resize_mutex);
+    if (__atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST) ||
+        __atomic_load_n(&pool->pool_size, __ATOMIC_SEQ_CST) >= pool->max_threads) {
+        pthread_mutex_unlock(&pool->resize_mutex);
+        return;
+    }
+
+    Worker* worker = NULL;
+    int state = WORKER_RUNNING;
+    for (size_t i = 0; i < pool->max_threads && worker == NULL; ++i) {
+        state = __atomic_load_n(&pool->workers[i].state, __ATOMIC_ACQUIRE);
+        if (state != WORKER_RUNNING)
+            worker = &pool->workers[i];
+    }
+    // A retiring worker leaves the count before its slot, so the slot may
+    // not be free yet
+    if (worker == NULL) {
+        pthread_mutex_unlock(&pool->resize_mutex);
+        return;
+    }
+    if (state == WORKER_RETIRED && pthread_join(pool->threads[worker->id], NULL) != 0)
+        ERR_AND_EXIT("Failed to join threads.");
+
+    __atomic_add_fetch(&pool->pool_size, 1, __ATOMIC_SEQ_CST);
+    _yatpool_start_worker(pool, worker);
+    pthread_mutex_unlock(&pool->resize_mutex);
+}
+
+/// Check whether an elastic pool should add a worker for a queue holding
+/// depth tasks: it has fewer than max_threads, and the tasks outnumber the
+/// idle workers by grow_queue_depth
+bool _yatpool_should_grow(YATPool* pool, size_t depth) {
+    if (__atomic_load_n(&pool->pool_size, __ATOMIC_RELAXED) >= pool->max_threads)
+        return false;
+    size_t idle = (size_t)__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) +
+                  (size_t)__atomic_load_n(&pool->spinners, __ATOMIC_SEQ_CST);
+    return depth >= pool->grow_queue_depth + idle;
+}
+
+/// Add a worker to an elastic pool if a task about to run has been queued
+/// for longer than grow_wait_ns while no worker was idle
+void _yatpool_check_delay(YATPool* pool, Task* task) {
+    if (__atomic_load_n(&pool->pool_size, __ATOMIC_RELAXED) < pool->max_threads &&
+        _yatpool_now_ns() - task->queued_at >= pool->grow_wait_ns &&
+        __atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&pool->spinners, __ATOMIC_SEQ_CST) == 0)
+        _yatpool_grow(pool);
+}
+
+/// Fill a YATPoolOptions struct with the default options
+void yatpool_options_init(YATPoolOptions* options, size_t num_threads, size_t num_tasks) {
+    if (options==NULL) {
+        ERR("options pointer is null.");
+        return;
+    }
+    options->num_threads = num_threads;
+    options->num_tasks = num_tasks;
+    options->queue_size = YATPOOL_DEFAULT_QUEUE_SIZE;
+    options->overflow = YATPOOL_OVERFLOW_BLOCK;
+    options->scheduler = YATPOOL_SCHED_GLOBAL_QUEUE;
+    options->queue_type = YATPOOL_QUEUE_LOCKED;
+    options->num_priorities = 1;
+    options->affinity = YATPOOL_AFFINITY_NONE;
+    options->cpus = NULL;
+    options->num_cpus = 0;
+    options->spin_count = 0;
+    options->yield_count = 0;
+    options->parking = YATPOOL_PARK_FUTEX;
+    options->min_threads = 0;
+    options->max_threads = 0;
+    options->grow_queue_depth = 1;
+    options->grow_wait_us = 0;
+    options->keep_alive_ms = 10000;
+    options->worker_init = NULL;
+    options->worker_teardown = NULL;
+    options->worker_arg = NULL;
+}
+
+/// Initialize a thread pool with the given options.
+void yatpool_init_with_options(YATPool** pool, const YATPoolOptions* options) {
+    if (options==NULL) {
+        ERR("options pointer is null.");
+        return;
+    }
+    bool pinned_per_cpu = options->affinity == YATPOOL_AFFINITY_PER_CORE ||
+                          options->affinity == YATPOOL_AFFINITY_NUMA;
+    if (options->num_threads==0 && !pinned_per_cpu) ERR_AND_EXIT("num_threads cannot be zero.");
+    if (options->affinity==YATPOOL_AFFINITY_CPU_SET && (options->cpus==NULL || options->num_cpus==0))
+        ERR_AND_EXIT("cpus cannot be empty with YATPOOL_AFFINITY_CPU_SET.");
+    if (options->queue_size==0) ERR_AND_EXIT("queue_size cannot be zero.");
+    if (options->num_priorities==0 || options->num_priorities>YATPOOL_MAX_PRIORITIES)
+        ERR_AND_EXIT("num_priorities must be between 1 and YATPOOL_MAX_PRIORITIES.");
+    if (options->grow_queue_depth==0) ERR_AND_EXIT("grow_queue_depth cannot be zero.");
+
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+
+    *pool = (YATPool*)malloc(sizeof(YATPool));
+
+    // Find the CPUs the workers are placed on. Only the NUMA mode keeps
+    // one node per NUMA node; the others see the machine as one node.
+    (*pool)->affinity = options->affinity;
+    (*pool)->next_node = 0;
+    if (options->affinity == YATPOOL_AFFINITY_NUMA) {
+        (*pool)->num_nodes = _topology_discover_nodes(&(*pool)->node_cpus, &(*pool)->node_ids);
+    } else {
+        (*pool)->num_nodes = 1;
+        (*pool)->node_ids = NULL;
+        (*pool)->node_cpus = (cpu_set_t*)malloc(sizeof(cpu_set_t));
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &(*pool)->node_cpus[0]) != 0)
+            ERR_AND_EXIT("Could not get the CPU affinity of the process.");
+        if (options->affinity == YATPOOL_AFFINITY_CPU_SET) {
+            CPU_ZERO(&(*pool)->node_cpus[0]);
+            for (size_t i = 0; i < options->num_cpus; ++i) {
+                if (options->cpus[i] >= 0 && options->cpus[i] < CPU_SETSIZE)
+                    CPU_SET(options->cpus[i], &(*pool)->node_cpus[0]);
+            }
+            if (CPU_COUNT(&(*pool)->node_cpus[0]) == 0)
+                ERR_AND_EXIT("cpus holds no valid CPU.");
+        }
+    }
+
+    // Without a thread count, there is one worker per allowed CPU
+    size_t num_threads = options->num_threads;
+    if (num_threads == 0) {
+        for (size_t i = 0; i < (*pool)->num_nodes; ++i)
+            num_threads += CPU_COUNT(&(*pool)->node_cpus[i]);
+    }
+
+    // An elastic pool starts with num_threads workers and has a slot for
+    // every worker it may grow to
+    size_t min_threads = options->min_threads == 0? num_threads: options->min_threads;
+    size_t max_threads = options->max_threads == 0? num_threads: options->max_threads;
+    if (min_threads > num_threads || max_threads < num_threads)
+        ERR_AND_EXIT("num_threads must be between min_threads and max_threads.");
+    (*pool)->min_threads = min_threads;
+    (*pool)->max_threads = max_threads;
+    (*pool)->grow_queue_depth = options->grow_queue_depth;
+    (*pool)->grow_wait_ns = max_threads > num_threads? (uint64_t)options->grow_wait_us * 1000u: 0;
+    (*pool)->keep_alive_ns = (uint64_t)options->keep_alive_ms * 1000000u;
+    (*pool)->worker_init = options->worker_init;
+    (*pool)->worker_teardown = options->worker_teardown;
+    (*pool)->worker_arg = options->worker_arg;
+
+    (*pool)->threads = (pthread_t*)calloc(max_threads, sizeof(pthread_t));
+    if (posix_memalign((void**)&(*pool)->workers, 64, max_threads * sizeof(Worker)) != 0)
+        ERR_AND_EXIT("Could not allocate workers.");
+    
+    size_t num_queues = (*pool)->num_nodes * options->num_priorities;
+    (*pool)->num_lanes = options->num_priorities;
+    (*pool)->task_queues = NULL;
+    (*pool)->mpmc_queues = NULL;
+    if (options->queue_type == YATPOOL_QUEUE_LOCK_FREE) {
+        (*pool)->mpmc_queues = (MPMCQueue**)calloc(num_queues, sizeof(MPMCQueue*));
+        for (size_t i = 0; i < num_queues; ++i)
+            mpmcqueue_init(&(*pool)->mpmc_queues[i], options->queue_size);
+    } else {
+        (*pool)->task_queues = (TaskQueue**)calloc(num_queues, sizeof(TaskQueue*));
+        for (size_t i = 0; i < num_queues; ++i)
+            taskqueue_init(&(*pool)->task_queues[i], options->queue_size);
+    }
+    (*pool)->lane_skips = (size_t*)calloc(num_queues, sizeof(size_t));
+    (*pool)->lane_max_depth = (size_t*)calloc(num_queues, sizeof(size_t));
+
+    // A pool without a task count streams tasks and keeps no results
+    (*pool)->streaming = options->num_tasks == 0;
+    (*pool)->retvalarr = NULL;
+    if (!(*pool)->streaming)
+        (*pool)->retvalarr = (void**)calloc(options->num_tasks, sizeof(void*));
+    
+    pthread_attr_init(&(*pool)->attr);
+    pthread_cond_init(&(*pool)->cond_queue, NULL);
+    pthread_cond_init(&(*pool)->cond_slot_available, NULL);
+    pthread_cond_init(&(*pool)->cond_done, NULL);
+    pthread_cond_init(&(*pool)->cond_future, NULL);
+    pthread_mutex_init(&(*pool)->mutex, NULL);
+    pthread_mutex_init(&(*pool)->slab_mutex, NULL);
+    pthread_mutex_init(&(*pool)->idle_mutex, NULL);
+    pthread_mutex_init(&(*pool)->resize_mutex, NULL);
+
+    (*pool)->total_tasks = options->num_tasks;
+    (*pool)->pool_size = num_threads;
+    (*pool)->scheduler = options->scheduler;
+    (*pool)->queue_type = options->queue_type;
+    (*pool)->overflow = options->overflow;
+    (*pool)->sleepers = 0;
+    (*pool)->spinners = 0;
+    (*pool)->parking = options->parking;
+    (*pool)->idle_workers = (Worker**)calloc(max_threads, sizeof(Worker*));
+    (*pool)->num_idle = 0;
+    (*pool)->spin_count = options->spin_count;
+    (*pool)->yield_count = options->yield_count;
+    (*pool)->slot_waiters = 0;
+    (*pool)->future_waiters = 0;
+    (*pool)->quiesce_waiters = 0;
+    (*pool)->in_flight = 0;
+    if (posix_memalign((void**)&(*pool)->producers, 64, PRODUCER_SLOTS * sizeof(ProducerSlot)) != 0)
+        ERR_AND_EXIT("Could not allocate producer slots.");
+    for (size_t i = 0; i < PRODUCER_SLOTS; ++i)
+        (*pool)->producers[i].tasks_submitted = 0;
+    (*pool)->slot_wait_ns = 0;
+    (*pool)->tasks_blocked = 0;
+    (*pool)->tasks_rejected = 0;
+    (*pool)->tasks_caller_ran = 0;
+    (*pool)->tasks_dropped = 0;
+    (*pool)->tasks_cancelled = 0;
+    (*pool)->callers.tasks_executed = 0;
+    (*pool)->callers.busy_ns = 0;
+#ifdef YATPOOL_TRACE
+    (*pool)->callers.trace.events = (TraceEvent*)malloc(TRACE_BUFFER_SIZE * sizeof(TraceEvent));
+    (*pool)->callers.trace.head = 0;
+    pthread_mutex_init(&(*pool)->callers.trace_mutex, NULL);
+    (*pool)->trace_start_ns = _yatpool_now_ns();
+#endif
+    (*pool)->done = false;
+    (*pool)->shutdown = false;
+    (*pool)->next_result = 0;
+    (*pool)->completed = 0;
+    (*pool)->free_tasks = NULL;
+    (*pool)->slab_chunks = NULL;
+    (*pool)->slab_hits = 0;
+    (*pool)->slab_misses = 0;
+
+    _yatpool_create_threads(*pool);
+}
+
+/// Initialize a thread pool.
+void yatpool_init(YATPool** pool, size_t num_threads, size_t num_tasks) {
+    YATPoolOptions options;
+    yatpool_options_init(&options, num_threads, num_tasks);
+    yatpool_init_with_options(pool, &options);
+}
+
+/// Wait for a consumer to signal that a queue slot is available, counting
+/// the time blocked, until the deadline if not NULL. Called with the mutex
+/// held.
+void _yatpool_wait_slot_available(YATPool* pool, const struct timespec* deadline) {
+    uint64_t start = _yatpool_now_ns();
+    if (deadline == NULL)
+        pthread_cond_wait(&pool->cond_slot_available, &pool->mutex);
+    else
+        pthread_cond_timedwait(&pool->cond_slot_available, &pool->mutex, deadline);
+    pool->slot_wait_ns += _yatpool_now_ns() - start;
+}
+
+/// Wait until a lock-free queue has drained to half its length, or until
+/// the deadline if not NULL. The producer registers as a waiter and checks
+/// once more before sleeping, so that a consumer draining the queue either
+/// is seen here or sees the waiter and signals it.
+void _yatpool_wait_for_slot(YATPool* pool, size_t queue, const struct timespec* deadline) {
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_add_fetch(&pool->slot_waiters, 1, __ATOMIC_SEQ_CST);
+    if (mpmcqueue_size(pool->mpmc_queues[queue]) > pool->mpmc_queues[queue]->length / 2)
+        _yatpool_wait_slot_available(pool, deadline);
+    __atomic_sub_fetch(&pool->slot_waiters, 1, __ATOMIC_SEQ_CST);
     pthread_mutex_unlock(&pool->mutex);
+}
+
+/// Get the realtime clock deadline, as taken by pthread_cond_timedwait,
+/// some nanoseconds from now
+void _yatpool_deadline(struct timespec* deadline, uint64_t timeout_ns) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    uint64_t nsec = (uint64_t)deadline->tv_nsec + timeout_ns;
+    deadline->tv_sec += (time_t)(nsec / 1000000000u);
+    deadline->tv_nsec = (long)(nsec % 1000000000u);
+}
+
+/// Check whether a realtime clock deadline has passed
+bool _yatpool_expired(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/// Outcome of a submission that found the queue of its task full
+typedef enum {
+    OVERFLOW_RETRY,             // Try to queue the task again
+    OVERFLOW_DONE,              // The task was run by the submitter
+    OVERFLOW_REFUSED            // The task was not queued and is left to the submitter
+} OverflowOutcome;
+
+/// Deal with a task that found its queue full, by an overflow policy. In
+/// the locked mode it is called, and returns, with the mutex held, which is
+/// released while tasks run. A blocked submission is refused once its
+/// deadline, if not NULL, has passed. first is set on the first call for a
+/// submission, which counts it as blocked.
+OverflowOutcome _yatpool_overflow(YATPool* pool, size_t queue, Task* task, YATPoolOverflow overflow,
+                                  const struct timespec* deadline, bool first) {
+    bool locked = pool->queue_type != YATPOOL_QUEUE_LOCK_FREE;
+
+    switch (overflow) {
+    case YATPOOL_OVERFLOW_REJECT:
+        __atomic_add_fetch(&pool->tasks_rejected, 1, __ATOMIC_RELAXED);
+        return OVERFLOW_REFUSED;
+
+    case YATPOOL_OVERFLOW_CALLER_RUNS:
+        __atomic_add_fetch(&pool->tasks_caller_ran, 1, __ATOMIC_RELAXED);
+        if (locked)
+            pthread_mutex_unlock(&pool->mutex);
+        _yatpool_run(pool, task, _yatpool_now_ns());
+        if (locked)
+            pthread_mutex_lock(&pool->mutex);
+        return OVERFLOW_DONE;
+
+    case YATPOOL_OVERFLOW_DROP_OLDEST: {
+        // The queue may have drained meanwhile. Tasks run on behalf of the
+        // pool cannot be dropped and are run here instead.
+        Task* oldest = locked? (Task *)taskqueue_pop(pool->task_queues[queue]):
+                               (Task *)mpmcqueue_pop(pool->mpmc_queues[queue]);
+        if (oldest == NULL)
+            return OVERFLOW_RETRY;
+        if (locked)
+            pthread_mutex_unlock(&pool->mutex);
+        if (oldest->internal) {
+            _yatpool_run(pool, oldest, _yatpool_now_ns());
+        } else {
+            __atomic_add_fetch(&pool->tasks_dropped, 1, __ATOMIC_RELAXED);
+            _yatpool_discard(pool, oldest);
+        }
+        if (locked)
+            pthread_mutex_lock(&pool->mutex);
+        return OVERFLOW_RETRY;
+    }
+
+    default:
+        if (first)
+            __atomic_add_fetch(&pool->tasks_blocked, 1, __ATOMIC_RELAXED);
+        if (deadline != NULL && _yatpool_expired(deadline)) {
+            __atomic_add_fetch(&pool->tasks_rejected, 1, __ATOMIC_RELAXED);
+            return OVERFLOW_REFUSED;
+        }
+
+        // A worker runs queued tasks instead of waiting, as all workers
+        // blocking here would never see a free slot
+        if (_yatpool_on_worker(pool)) {
+            if (locked)
+                pthread_mutex_unlock(&pool->mutex);
+            if (!_yatpool_help(pool))
+                sched_yield();
+            if (locked)
+                pthread_mutex_lock(&pool->mutex);
+        } else if (locked) {
+            _yatpool_wait_slot_available(pool, deadline);
+        } else {
+            _yatpool_wait_for_slot(pool, queue, deadline);
+        }
+        return OVERFLOW_RETRY;
+    }
+}
+
+/// Check that a task can be submitted to a pool
+bool _yatpool_check_task(YATPool* pool, Task* task) {
+    if (task==NULL) {
+        ERR("task pointer is null.");
+        return false;
+    }
+    if (task->slab_pool!=NULL && task->slab_pool!=pool) {
+        ERR("task was allocated from the slab of another pool.");
+        return false;
+    }
+    return true;
+}
+
+/// Add n to the count of tasks the current thread submitted to a pool, or
+/// take one back with n = (size_t)-1. A worker counts on its own slot, other
+/// threads on the producer slot they were given, so that submitting
+/// does not contend on a counter shared by the whole pool.
+void _yatpool_count_submitted(YATPool* pool, size_t n) {
+    Worker* worker = _yatpool_current_worker;
+    if (worker != NULL && worker->pool == pool) {
+        __atomic_store_n(&worker->tasks_submitted, worker->tasks_submitted + n, __ATOMIC_RELAXED);
+        return;
+    }
+    if (_yatpool_producer_slot == SIZE_MAX)
+        _yatpool_producer_slot = __atomic_fetch_add(&_yatpool_next_producer_slot, 1, __ATOMIC_RELAXED) % PRODUCER_SLOTS;
+    __atomic_add_fetch(&pool->producers[_yatpool_producer_slot].tasks_submitted, n, __ATOMIC_RELAXED);
+}
+
+/// Count tasks about to be queued as submitted, and as in flight until they
+/// have executed. Tasks run on behalf of the pool are not counted.
+void _yatpool_count_in_flight(YATPool* pool, Task** tasks, size_t num_tasks) {
+    size_t n = 0;
+    for (size_t i = 0; i < num_tasks; ++i) {
+        if (!tasks[i]->internal)
+            n++;
+    }
+    if (n > 0) {
+        __atomic_add_fetch(&pool->in_flight, n, __ATOMIC_RELAXED);
+        _yatpool_count_submitted(pool, n);
+    }
+}
+
+/// Get the priority lane of the shared queue a task goes to
+size_t _yatpool_task_lane(YATPool* pool, Task* task) {
+    return task->priority < pool->num_lanes? task->priority: pool->num_lanes - 1;
+}
+
+/// Get the node of a pool whose NUMA node id a task was hinted to, or -1 if
+/// it has no hint or the pool has no node of that id
+int _yatpool_task_node(YATPool* pool, Task* task) {
+    if (task->node < 0 || pool->node_ids == NULL)
+        return -1;
+    size_t low = 0, high = pool->num_nodes;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (pool->node_ids[mid] < task->node)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low < pool->num_nodes && pool->node_ids[low] == task->node? (int)low: -1;
+}
+
+/// Get the queue of the pool a task goes to: the lane of its priority, in
+/// the queue of its node hint, of the submitting worker's node, or of the
+/// next node in turn
+size_t _yatpool_task_queue(YATPool* pool, Task* task) {
+    size_t node = 0;
+    if (pool->num_nodes > 1) {
+        Worker* worker = _yatpool_current_worker;
+        int hinted = _yatpool_task_node(pool, task);
+        if (hinted >= 0)
+            node = (size_t)hinted;
+        else if (worker != NULL && worker->pool == pool)
+            node = worker->node;
+        else
+            node = __atomic_fetch_add(&pool->next_node, 1, __ATOMIC_RELAXED) % pool->num_nodes;
+    }
+    return node * pool->num_lanes + _yatpool_task_lane(pool, task);
+}
+
+/// Record the depth of a queue after a task was added to it. Returns true
+/// if the pool should add a worker for it.
+bool _yatpool_note_depth(YATPool* pool, size_t queue) {
+    size_t depth = _yatpool_lane_size(pool, queue);
+    size_t max_depth = __atomic_load_n(&pool->lane_max_depth[queue], __ATOMIC_RELAXED);
+    while (depth > max_depth &&
+           !__atomic_compare_exchange_n(&pool->lane_max_depth[queue], &max_depth, depth, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return _yatpool_should_grow(pool, depth);
+}
+
+/// Note when tasks are queued, if the pool grows on queueing delay
+void _yatpool_stamp(YATPool* pool, Task** tasks, size_t num_tasks) {
+    if (pool->grow_wait_ns == 0)
+        return;
+    uint64_t now = _yatpool_now_ns();
+    for (size_t i = 0; i < num_tasks; ++i)
+        tasks[i]->queued_at = now;
+}
+
+/// Check whether a task submitted from the current thread goes to the deque
+/// of its worker. Only tasks of the highest priority do, as the deque is
+/// served before the shared queue, and only if they are not meant for
+/// another node.
+bool _yatpool_enqueue_locally(YATPool* pool, Task* task) {
+    Worker* worker = _yatpool_current_worker;
+    if (worker == NULL || worker->pool != pool || worker->deque == NULL || _yatpool_task_lane(pool, task) != 0)
+        return false;
+    int node = _yatpool_task_node(pool, task);
+    return node < 0 || (size_t)node == worker->node;
+}
+
+/// Get the overflow policy a task is submitted by. Tasks run on behalf of
+/// the pool always wait for a slot.
+YATPoolOverflow _yatpool_task_overflow(YATPool* pool, Task* task) {
+    return task->internal? YATPOOL_OVERFLOW_BLOCK: pool->overflow;
+}
+
+/// Queue a task that is ready to run, dealing with a full queue by an
+/// overflow policy. Returns false if the task was refused, in which case it
+/// is left to the caller.
+bool _yatpool_enqueue_with(YATPool* pool, Task* task, YATPoolOverflow overflow, const struct timespec* deadline) {
+    _yatpool_stamp(pool, &task, 1);
+
+    // Tasks submitted from inside a work-stealing worker go to its own deque
+    if (_yatpool_enqueue_locally(pool, task)) {
+        taskdeque_push(_yatpool_current_worker->deque, (void *)task);
+        _yatpool_notify(pool, 1);
+        return true;
+    }
+
+    size_t queue = _yatpool_task_queue(pool, task);
+    bool first = true;
+    if (pool->queue_type == YATPOOL_QUEUE_LOCK_FREE) {
+        while (!mpmcqueue_put(pool->mpmc_queues[queue], (void *)task)) {
+            OverflowOutcome outcome = _yatpool_overflow(pool, queue, task, overflow, deadline, first);
+            first = false;
+            if (outcome != OVERFLOW_RETRY)
+                return outcome == OVERFLOW_DONE;
+        }
+        bool grow = _yatpool_note_depth(pool, queue);
+        _yatpool_notify(pool, 1);
+        if (grow)
+            _yatpool_grow(pool);
+        return true;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    
+    // If the queue is full, deal with the task by the overflow policy
+    while (taskqueue_full(pool->task_queues[queue])) {
+        OverflowOutcome outcome = _yatpool_overflow(pool, queue, task, overflow, deadline, first);
+        first = false;
+        if (outcome != OVERFLOW_RETRY) {
+            pthread_mutex_unlock(&pool->mutex);
+            return outcome == OVERFLOW_DONE;
+        }
+    }
+
+    // Once the queue has space, add task to it and wake a worker if one is
+    // parked
+    taskqueue_put(pool->task_queues[queue], (void *)task);
+    bool grow = _yatpool_note_depth(pool, queue);
+    bool futex = pool->parking == YATPOOL_PARK_FUTEX;
+    if (!futex)
+        _yatpool_wake(pool, 1);
+    pthread_mutex_unlock(&pool->mutex);
+    if (futex)
+        _yatpool_notify(pool, 1);
+
+    // The new worker is started outside the lock, which it needs right away
+    if (grow)
+        _yatpool_grow(pool);
+    return true;
+}
+
+/// Queue a task that is ready to run by the overflow policy of the pool,
+/// discarding it if it is refused
+void _yatpool_enqueue(YATPool* pool, Task* task) {
+    if (!_yatpool_enqueue_with(pool, task, _yatpool_task_overflow(pool, task), NULL))
+        _yatpool_discard(pool, task);
+}
+
+/// Submit a task to a threadpool. A task with unfinished dependencies is
+/// held until the last of them finishes.
+void yatpool_put(YATPool* pool, Task* task) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (!_yatpool_check_task(pool, task))
+        return;
+    _yatpool_count_in_flight(pool, &task, 1);
+    TRACE_SUBMIT(task);
+
+    if (__atomic_sub_fetch(&task->unmet_deps, 1, __ATOMIC_ACQ_REL) == 0)
+        _yatpool_enqueue(pool, task);
+}
+
+/// Submit a task to a threadpool by an overflow policy, until a deadline if
+/// not NULL. A refused task is taken back, so that it can be submitted
+/// again.
+bool _yatpool_put_with(YATPool* pool, Task* task, YATPoolOverflow overflow, const struct timespec* deadline) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return false;
+    }
+    if (!_yatpool_check_task(pool, task))
+        return false;
+    _yatpool_count_in_flight(pool, &task, 1);
+    TRACE_SUBMIT(task);
+
+    if (__atomic_sub_fetch(&task->unmet_deps, 1, __ATOMIC_ACQ_REL) != 0)
+        return true;
+    if (_yatpool_enqueue_with(pool, task, overflow, deadline))
+        return true;
+
+    __atomic_add_fetch(&task->unmet_deps, 1, __ATOMIC_ACQ_REL);
+    _yatpool_count_submitted(pool, (size_t)-1);
+    _yatpool_drained(pool);
+    return false;
+}
+
+/// Submit a task to a threadpool without blocking. Returns false, leaving
+/// the task to the caller to submit again or free with task_destroy, if its
+/// queue is full. A task with unfinished
+/// dependencies is held as by yatpool_put, and the overflow policy of the
+/// pool applies when it is released.
+bool yatpool_try_put(YATPool* pool, Task* task) {
+    return _yatpool_put_with(pool, task, YATPOOL_OVERFLOW_REJECT, NULL);
+}
+
+/// Submit a task to a threadpool, waiting at most timeout_us microseconds
+/// for a slot if its queue is full. Returns false, leaving the task to the
+/// caller to submit again or free with task_destroy, if none freed up in
+/// time.
+bool yatpool_put_timed(YATPool* pool, Task* task, size_t timeout_us) {
+    struct timespec deadline;
+    _yatpool_deadline(&deadline, (uint64_t)timeout_us * 1000u);
+    return _yatpool_put_with(pool, task, YATPOOL_OVERFLOW_BLOCK, &deadline);
+}
+
+/// Queue several tasks that are ready to run. As many tasks as fit in the
+/// queue are added under a single lock acquisition, and only as many workers
+/// are woken as there are new tasks.
+void _yatpool_enqueue_batch(YATPool* pool, Task** tasks, size_t num_tasks) {
+    _yatpool_stamp(pool, tasks, num_tasks);
+
+    Worker* worker = _yatpool_current_worker;
+    if (worker != NULL && worker->pool == pool && worker->deque != NULL) {
+        size_t pushed = 0;
+        for (size_t i = 0; i < num_tasks; ++i) {
+            if (_yatpool_enqueue_locally(pool, tasks[i])) {
+                taskdeque_push(worker->deque, (void *)tasks[i]);
+                pushed++;
+            } else {
+                _yatpool_enqueue(pool, tasks[i]);
+            }
+        }
+        _yatpool_notify(pool, pushed);
+        return;
+    }
+
+    if (pool->queue_type == YATPOOL_QUEUE_LOCK_FREE) {
+        // Wake workers for the tasks added so far before waiting for a slot,
+        // as they are the ones who will free it
+        size_t pending = 0;
+        bool grow = false;
+        for (size_t i = 0; i < num_tasks; ++i) {
+            size_t queue = _yatpool_task_queue(pool, tasks[i]);
+            OverflowOutcome outcome = OVERFLOW_RETRY;
+            bool first = true;
+            while (!mpmcqueue_put(pool->mpmc_queues[queue], (void *)tasks[i])) {
+                _yatpool_notify(pool, pending);
+                pending = 0;
+                outcome = _yatpool_overflow(pool, queue, tasks[i], _yatpool_task_overflow(pool, tasks[i]),
+                                            NULL, first);
+                first = false;
+                if (outcome != OVERFLOW_RETRY)
+                    break;
+            }
+            if (outcome == OVERFLOW_REFUSED)
+                _yatpool_discard(pool, tasks[i]);
+            if (outcome != OVERFLOW_RETRY)
+                continue;
+            grow |= _yatpool_note_depth(pool, queue);
+            pending++;
+        }
+        _yatpool_notify(pool, pending);
+        if (grow)
+            _yatpool_grow(pool);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    size_t added = 0;
+    bool grow = false;
+    for (size_t i = 0; i < num_tasks; ++i) {
+        size_t queue = _yatpool_task_queue(pool, tasks[i]);
+        OverflowOutcome outcome = OVERFLOW_RETRY;
+        bool first = true;
+        // Workers must be woken for the tasks already queued before the
+        // queue can drain. Waking them may release the mutex, so the queue
+        // is checked again.
+        if (taskqueue_full(pool->task_queues[queue])) {
+            _yatpool_wake_queued(pool, added);
+            added = 0;
+        }
+        while (taskqueue_full(pool->task_queues[queue])) {
+            outcome = _yatpool_overflow(pool, queue, tasks[i], _yatpool_task_overflow(pool, tasks[i]),
+                                        NULL, first);
+            first = false;
+            if (outcome != OVERFLOW_RETRY)
+                break;
+        }
+        if (outcome == OVERFLOW_REFUSED) {
+            pthread_mutex_unlock(&pool->mutex);
+            _yatpool_discard(pool, tasks[i]);
+            pthread_mutex_lock(&pool->mutex);
+        }
+        if (outcome != OVERFLOW_RETRY)
+            continue;
+        taskqueue_put(pool->task_queues[queue], (void *)tasks[i]);
+        grow |= _yatpool_note_depth(pool, queue);
+        added++;
+    }
+    bool futex = pool->parking == YATPOOL_PARK_FUTEX;
+    if (!futex)
+        _yatpool_wake(pool, added);
+
+    pthread_mutex_unlock(&pool->mutex);
+    if (futex)
+        _yatpool_notify(pool, added);
+    if (grow)
+        _yatpool_grow(pool);
+}
+
+/// Submit several tasks to a threadpool at once. Tasks with unfinished
+/// dependencies are held until the last of them finishes.
+void yatpool_put_batch(YATPool* pool, Task** tasks, size_t num_tasks) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (tasks==NULL) {
+        ERR("tasks pointer is null.");
+        return;
+    }
+    for (size_t i = 0; i < num_tasks; ++i) {
+        if (!_yatpool_check_task(pool, tasks[i]))
+            return;
+        TRACE_SUBMIT(tasks[i]);
+    }
+    _yatpool_count_in_flight(pool, tasks, num_tasks);
+
+    // The ready tasks are queued in place, unless held tasks have to be
+    // left out, in which case they are gathered into a copy
+    Task** ready = tasks;
+    size_t num_ready = 0;
+    for (size_t i = 0; i < num_tasks; ++i) {
+        if (__atomic_sub_fetch(&tasks[i]->unmet_deps, 1, __ATOMIC_ACQ_REL) != 0)
+            continue;
+        if (ready == tasks && num_ready != i) {
+            ready = (Task**)malloc(num_tasks * sizeof(Task*));
+            memcpy(ready, tasks, num_ready * sizeof(Task*));
+        }
+        ready[num_ready++] = tasks[i];
+    }
+    if (num_ready > 0)
+        _yatpool_enqueue_batch(pool, ready, num_ready);
+    if (ready != tasks)
+        free(ready);
+}
+
+/// Submit a task to a threadpool and get a future for its result. The task
+/// is not counted in the current batch and its result does not go to the
+/// array returned by yatpool_wait. The future must be destroyed with
+/// future_destroy.
+Future* yatpool_submit(YATPool* pool, Task* task) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return NULL;
+    }
+    if (!_yatpool_check_task(pool, task))
+        return NULL;
 
-    for (size_t i = 0; i < pool->pool_size; ++i) {
-        if (pthread_join(pool->threads[i], NULL) != 0) 
-            ERR_AND_EXIT("Failed to join threads.");
+    Future* future = (Future*)malloc(sizeof(Future));
+    future->pool = pool;
+    future->result = NULL;
+    future->done = false;
+    future->refs = 2;
+    task->future = future;
+
+    yatpool_put(pool, task);
+    return future;
+}
+
+/// Initialize a group of tasks of a thread pool, which can be waited for
+/// without waiting for the rest of the pool
+void yatpool_group_init(YATPool* pool, YATPoolGroup** group) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
     }
-    return pool->retvalarr;
+    if (group==NULL) {
+        ERR("group pointer is null.");
+        return;
+    }
+
+    *group = (YATPoolGroup *)malloc(sizeof(YATPoolGroup));
+    if (*group==NULL) {
+        ERR_AND_EXIT("Failed to allocate memory for the group.");
+    }
+    (*group)->pool = pool;
+    (*group)->pending = 0;
+    pthread_mutex_init(&(*group)->mutex, NULL);
+    pthread_cond_init(&(*group)->cond_done, NULL);
+}
+
+/// Put a task in the pool of a group. The task is not part of the batch of
+/// the pool: its result is freed once it has run.
+void yatpool_group_put(YATPoolGroup* group, Task* task) {
+    if (group==NULL) {
+        ERR("group pointer is null.");
+        return;
+    }
+    if (task==NULL) {
+        ERR("task pointer is null.");
+        return;
+    }
+    if (task->future != NULL || task->group != NULL) {
+        ERR("task was already submitted.");
+        return;
+    }
+
+    task->group = group;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+    yatpool_put(group->pool, task);
+}
+
+/// Wait until every task put in a group so far has run. The waiting thread
+/// runs pending tasks of the pool meanwhile, so a task may wait for a group
+/// of its own pool without tying up its worker.
+void yatpool_group_wait(YATPoolGroup* group) {
+    if (group==NULL) {
+        ERR("group pointer is null.");
+        return;
+    }
+
+    YATPool* pool = group->pool;
+    bool on_worker = _yatpool_on_worker(pool);
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        if (_yatpool_help(pool))
+            continue;
+
+        // Nothing left to run here: the remaining tasks are running on other
+        // threads. A worker only naps, as it may be needed for tasks they put.
+        pthread_mutex_lock(&group->mutex);
+        if (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+            if (on_worker) {
+                struct timespec deadline;
+                _yatpool_deadline(&deadline, 100000);
+                pthread_cond_timedwait(&group->cond_done, &group->mutex, &deadline);
+            } else {
+                pthread_cond_wait(&group->cond_done, &group->mutex);
+            }
+        }
+        pthread_mutex_unlock(&group->mutex);
+    }
+
+    // Let the last task leave _yatpool_group_finish before returning
+    pthread_mutex_lock(&group->mutex);
+    pthread_mutex_unlock(&group->mutex);
+}
+
+/// Wait for the pending tasks of a group and free it
+void yatpool_group_destroy(YATPoolGroup* group) {
+    if (group==NULL) {
+        ERR("group pointer is null.");
+        return;
+    }
+
+    yatpool_group_wait(group);
+    pthread_mutex_destroy(&group->mutex);
+    pthread_cond_destroy(&group->cond_done);
+    free(group);
+}
+
+/// Wait until every task submitted so far has executed, without joining the
+/// workers. More tasks may be submitted afterwards.
+void yatpool_quiesce(YATPool* pool) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (__atomic_load_n(&pool->in_flight, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_add_fetch(&pool->quiesce_waiters, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pool->in_flight, __ATOMIC_SEQ_CST) > 0) {
+        pthread_cond_wait(&pool->cond_done, &pool->mutex);
+    }
+    __atomic_sub_fetch(&pool->quiesce_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->mutex);
 }
 
-/// Join all threads in a thread pool.
-void** yatpool_join(YATPool* pool) {
+/// Wait until all tasks of the current batch are completed. The returned
+/// results stay owned by the pool until the next yatpool_reset or
+/// yatpool_destroy. A streaming pool has no batch: the call waits like
+/// yatpool_quiesce and returns NULL.
+void** yatpool_wait(YATPool* pool) {
     if (pool==NULL) {
         ERR("yatpool pointer is null.");
         return NULL;
     }
-    for (size_t i = 0; i < pool->pool_size; ++i) {
-        if (pthread_join(pool->threads[i], NULL) != 0) 
-            ERR_AND_EXIT("Failed to join threads.");
+    if (pool->streaming) {
+        yatpool_quiesce(pool);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (!pool->done) {
+        pthread_cond_wait(&pool->cond_done, &pool->mutex);
     }
+    pthread_mutex_unlock(&pool->mutex);
+
     return pool->retvalarr;
 }
 
-/// Reset a thread pool without joining threads or destroying it.
+/// Wait at most timeout_us microseconds for the tasks of the current batch
+/// to complete, or for those in flight to drain on a streaming pool.
+/// Returns false if they had not by then. Once it returns true, the results
+/// can be taken with yatpool_wait, which then does not block.
+bool yatpool_wait_for(YATPool* pool, size_t timeout_us) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return false;
+    }
+
+    struct timespec deadline;
+    _yatpool_deadline(&deadline, (uint64_t)timeout_us * 1000u);
+    bool finished;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->streaming) {
+        __atomic_add_fetch(&pool->quiesce_waiters, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->in_flight, __ATOMIC_SEQ_CST) > 0) {
+            if (pthread_cond_timedwait(&pool->cond_done, &pool->mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        __atomic_sub_fetch(&pool->quiesce_waiters, 1, __ATOMIC_SEQ_CST);
+        finished = __atomic_load_n(&pool->in_flight, __ATOMIC_SEQ_CST) == 0;
+    } else {
+        while (!pool->done) {
+            if (pthread_cond_timedwait(&pool->cond_done, &pool->mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        finished = pool->done;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return finished;
+}
+
+/// Start a new batch of tasks on a thread pool whose previous batch has
+/// completed. The worker threads are kept alive across batches.
 void yatpool_reset(YATPool* pool, size_t num_tasks) {
     if (pool==NULL) {
         ERR("yatpool pointer is null.");
         return;
     }
     if (num_tasks==0) ERR_AND_EXIT("num_tasks cannot be zero.");
+    if (pool->streaming) {
+        ERR("a streaming pool has no batches to reset.");
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
     if (!(pool->done))
         ERR_AND_EXIT("Previous task pool not completed. Reset failed.");
 
-    taskqueue_clear(pool->task_queue);
+    for (int i=0; i<pool->total_tasks; ++i)
+        free(pool->retvalarr[i]);
+    if (num_tasks>(size_t)pool->total_tasks)
+        pool->retvalarr = (void**)realloc(pool->retvalarr, num_tasks * sizeof(void*));
+    memset(pool->retvalarr, 0, num_tasks * sizeof(void*));
+
     pool->done = false;
     pool->total_tasks = num_tasks;
-    pool->completed = 0;
+    __atomic_store_n(&pool->next_result, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->completed, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/// Take a snapshot of the statistics of a thread pool. The snapshot must be
+/// freed with yatpool_stats_destroy.
+void yatpool_stats(YATPool* pool, YATPoolStats* stats) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (stats==NULL) {
+        ERR("stats pointer is null.");
+        return;
+    }
+
+    pthread_mutex_lock(&pool->slab_mutex);
+    stats->slab_hits = pool->slab_hits;
+    stats->slab_misses = pool->slab_misses;
+    pthread_mutex_unlock(&pool->slab_mutex);
+
+    stats->num_workers = pool->max_threads;
+    stats->tasks_submitted = 0;
+    stats->workers = (YATPoolWorkerStats*)calloc(pool->max_threads, sizeof(YATPoolWorkerStats));
+    for (size_t i = 0; i < pool->max_threads; ++i) {
+        Worker* worker = &pool->workers[i];
+        YATPoolWorkerStats* entry = &stats->workers[i];
+        stats->slab_hits += __atomic_load_n(&worker->slab_hits, __ATOMIC_RELAXED);
+        stats->slab_misses += __atomic_load_n(&worker->slab_misses, __ATOMIC_RELAXED);
+        entry->running = __atomic_load_n(&worker->state, __ATOMIC_RELAXED) == WORKER_RUNNING;
+        entry->tasks_executed = __atomic_load_n(&worker->tasks_executed, __ATOMIC_RELAXED);
+        entry->busy_ns = __atomic_load_n(&worker->busy_ns, __ATOMIC_RELAXED);
+        entry->idle_ns = __atomic_load_n(&worker->idle_ns, __ATOMIC_RELAXED);
+        entry->steals = __atomic_load_n(&worker->steals, __ATOMIC_RELAXED);
+        stats->tasks_submitted += __atomic_load_n(&worker->tasks_submitted, __ATOMIC_RELAXED);
+    }
+    for (size_t i = 0; i < PRODUCER_SLOTS; ++i)
+        stats->tasks_submitted += __atomic_load_n(&pool->producers[i].tasks_submitted, __ATOMIC_RELAXED);
+    stats->callers.running = false;
+    stats->callers.tasks_executed = __atomic_load_n(&pool->callers.tasks_executed, __ATOMIC_RELAXED);
+    stats->callers.busy_ns = __atomic_load_n(&pool->callers.busy_ns, __ATOMIC_RELAXED);
+    stats->callers.idle_ns = 0;
+    stats->callers.steals = 0;
+    stats->tasks_blocked = __atomic_load_n(&pool->tasks_blocked, __ATOMIC_RELAXED);
+    stats->tasks_rejected = __atomic_load_n(&pool->tasks_rejected, __ATOMIC_RELAXED);
+    stats->tasks_caller_ran = __atomic_load_n(&pool->tasks_caller_ran, __ATOMIC_RELAXED);
+    stats->tasks_dropped = __atomic_load_n(&pool->tasks_dropped, __ATOMIC_RELAXED);
+    stats->tasks_cancelled = __atomic_load_n(&pool->tasks_cancelled, __ATOMIC_RELAXED);
+
+    // Lanes of the same priority on different nodes are reported together
+    pthread_mutex_lock(&pool->mutex);
+    stats->num_priorities = pool->num_lanes;
+    stats->num_nodes = pool->num_nodes;
+    stats->slot_wait_ns = pool->slot_wait_ns;
+    stats->max_queue_depth = 0;
+    for (size_t i = 0; i < YATPOOL_MAX_PRIORITIES; ++i) {
+        stats->lane_depth[i] = 0;
+        stats->lane_max_depth[i] = 0;
+        for (size_t node = 0; i < pool->num_lanes && node < pool->num_nodes; ++node) {
+            size_t queue = node * pool->num_lanes + i;
+            size_t max_depth = __atomic_load_n(&pool->lane_max_depth[queue], __ATOMIC_RELAXED);
+            stats->lane_depth[i] += _yatpool_lane_size(pool, queue);
+            if (max_depth > stats->lane_max_depth[i])
+                stats->lane_max_depth[i] = max_depth;
+        }
+        if (stats->lane_max_depth[i] > stats->max_queue_depth)
+            stats->max_queue_depth = stats->lane_max_depth[i];
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/// Free a snapshot taken by yatpool_stats
+void yatpool_stats_destroy(YATPoolStats* stats) {
+    if (stats==NULL) {
+        ERR("stats pointer is null.");
+        return;
+    }
+    free(stats->workers);
+    stats->workers = NULL;
+    stats->num_workers = 0;
+}
+
+#ifdef YATPOOL_TRACE
+/// Write a string as a JSON string literal
+void _trace_write_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (; *str != '\0'; ++str) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+/// Write the events of a trace buffer as the track tid of a trace file,
+/// numbering their "queued" slices from *id on
+void _trace_write_track(FILE* file, YATPool* pool, TraceBuffer* trace, size_t tid, const char* name, size_t* id) {
+    size_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    if (head == 0)
+        return;
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":", tid);
+    _trace_write_string(file, name);
+    fprintf(file, "}}");
+
+    size_t first = head > TRACE_BUFFER_SIZE? head - TRACE_BUFFER_SIZE: 0;
+    for (size_t n = first; n < head; ++n, ++*id) {
+        TraceEvent* event = &trace->events[n % TRACE_BUFFER_SIZE];
+        const char* label = event->label != NULL? event->label: "task";
+        double submit = (double)(event->submit_ns - pool->trace_start_ns) / 1000.0;
+        double dequeue = (double)(event->dequeue_ns - pool->trace_start_ns) / 1000.0;
+        double start = (double)(event->start_ns - pool->trace_start_ns) / 1000.0;
+        double end = (double)(event->end_ns - pool->trace_start_ns) / 1000.0;
+
+        fprintf(file, ",\n{\"name\":");
+        _trace_write_string(file, label);
+        fprintf(file, ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"args\":{\"queued_us\":%.3f}}", tid, start, end - start, dequeue - submit);
+        fprintf(file, ",\n{\"name\":");
+        _trace_write_string(file, label);
+        fprintf(file, ",\"cat\":\"queued\",\"ph\":\"b\",\"id\":%zu,\"pid\":1,\"tid\":%zu,\"ts\":%.3f}",
+                *id, tid, submit);
+        fprintf(file, ",\n{\"name\":");
+        _trace_write_string(file, label);
+        fprintf(file, ",\"cat\":\"queued\",\"ph\":\"e\",\"id\":%zu,\"pid\":1,\"tid\":%zu,\"ts\":%.3f}",
+                *id, tid, dequeue);
+    }
+}
+#endif
+
+/// Write the task events recorded by the workers of a pool to a file in the
+/// Chrome trace_event JSON format, which Perfetto and chrome://tracing open.
+/// Each task shows as a slice on the track of the worker that ran it, or
+/// on a "callers" track if a thread outside the pool ran it, and
+/// its time between submission and dequeue as an async "queued" slice.
+/// Timestamps are in microseconds since the pool was created. Should be
+/// called while the pool is idle, e.g. after yatpool_wait or
+/// yatpool_quiesce, as workers overwrite their oldest events when their
+/// buffer is full. Needs the library built with YATPOOL_TRACE.
+void yatpool_trace_dump(YATPool* pool, const char* path) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (path==NULL) {
+        ERR("path pointer is null.");
+        return;
+    }
+#ifdef YATPOOL_TRACE
+    FILE* file = fopen(path, "w");
+    if (file==NULL) {
+        ERR("Could not open the trace file.");
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"yatpool\"}}");
+    size_t id = 0;
+    char name[32];
+    for (size_t i = 0; i < pool->max_threads; ++i) {
+        snprintf(name, sizeof(name), "worker %zu", i);
+        _trace_write_track(file, pool, &pool->workers[i].trace, i, name, &id);
+    }
+    pthread_mutex_lock(&pool->callers.trace_mutex);
+    _trace_write_track(file, pool, &pool->callers.trace, pool->max_threads, "callers", &id);
+    pthread_mutex_unlock(&pool->callers.trace_mutex);
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0)
+        ERR("Could not write the trace file.");
+#else
+    ERR("yatpool was built without YATPOOL_TRACE.");
+#endif
 }
 
-/// Get the number of threads in a thread pool
+/// Get the context the worker_init hook returned for the worker running the
+/// current thread, or NULL on a thread that is not a worker of any pool
+void* yatpool_worker_ctx(void) {
+    Worker* worker = _yatpool_current_worker;
+    return worker != NULL? worker->ctx: NULL;
+}
+
+/// Get the id of the worker running the current thread, from 0 up to the
+/// largest size of its pool, or -1 on a thread that is not a worker of any
+/// pool
+int yatpool_worker_id(void) {
+    Worker* worker = _yatpool_current_worker;
+    return worker != NULL? (int)worker->id: -1;
+}
+
+/// Check whether the token of the task running on the current thread has
+/// been cancelled, so that a long task can stop early. Returns false outside
+/// a task or for a task without a token.
+bool yatpool_task_cancelled(void) {
+    CancelToken* token = _yatpool_current_token;
+    return token != NULL && __atomic_load_n(&token->cancelled, __ATOMIC_ACQUIRE);
+}
+
+/// Get the number of live threads in a thread pool
 size_t yatpool_pool_size(YATPool* pool) {
     if (pool==NULL) {
         ERR("yatpool pointer is null.");
         return 0;
     }
-    return pool->pool_size;
+    return __atomic_load_n(&pool->pool_size, __ATOMIC_RELAXED);
 }
 
 /// Destroy a thread pool.
@@ -371,12 +3056,70 @@ void yatpool_destroy(YATPool* pool) {
         ERR("yatpool pointer is null.");
         return;
     }
+
+    // Let the workers drain the queue and exit
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_store_n(&pool->shutdown, true, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&pool->cond_queue);
+    pthread_mutex_unlock(&pool->mutex);
+    if (pool->parking == YATPOOL_PARK_FUTEX)
+        _yatpool_unpark(pool, pool->max_threads);
+
+    // Once no worker is being added, join every thread ever started,
+    // including retired ones
+    pthread_mutex_lock(&pool->resize_mutex);
+    pthread_mutex_unlock(&pool->resize_mutex);
+    for (size_t i = 0; i < pool->max_threads; ++i) {
+        if (__atomic_load_n(&pool->workers[i].state, __ATOMIC_ACQUIRE) != WORKER_UNUSED &&
+            pthread_join(pool->threads[i], NULL) != 0)
+            ERR_AND_EXIT("Failed to join threads.");
+    }
+
+    // Tasks left in the queues go back to the slab, so the queues are
+    // destroyed before it
+    for (size_t i = 0; i < pool->num_nodes * pool->num_lanes; ++i) {
+        if (pool->task_queues != NULL)
+            taskqueue_destroy(pool->task_queues[i]);
+        if (pool->mpmc_queues != NULL)
+            mpmcqueue_destroy(pool->mpmc_queues[i]);
+    }
+    for (size_t i = 0; i < pool->max_threads; ++i) {
+        if (pool->workers[i].deque != NULL)
+            taskdeque_destroy(pool->workers[i].deque);
+#ifdef YATPOOL_TRACE
+        free(pool->workers[i].trace.events);
+#endif
+    }
+    free(pool->workers);
+    free(pool->producers);
+#ifdef YATPOOL_TRACE
+    free(pool->callers.trace.events);
+    pthread_mutex_destroy(&pool->callers.trace_mutex);
+#endif
+
+    while (pool->slab_chunks != NULL) {
+        SlabChunk* next = pool->slab_chunks->next;
+        free(pool->slab_chunks->tasks);
+        free(pool->slab_chunks);
+        pool->slab_chunks = next;
+    }
+
     pthread_attr_destroy(&pool->attr);
     pthread_cond_destroy(&pool->cond_queue);
     pthread_cond_destroy(&pool->cond_slot_available);
     pthread_cond_destroy(&pool->cond_done);
+    pthread_cond_destroy(&pool->cond_future);
     pthread_mutex_destroy(&pool->mutex);
-    taskqueue_destroy(pool->task_queue);
+    pthread_mutex_destroy(&pool->slab_mutex);
+    pthread_mutex_destroy(&pool->idle_mutex);
+    pthread_mutex_destroy(&pool->resize_mutex);
+    free(pool->idle_workers);
+    free(pool->task_queues);
+    free(pool->mpmc_queues);
+    free(pool->lane_skips);
+    free(pool->lane_max_depth);
+    free(pool->node_cpus);
+    free(pool->node_ids);
     free(pool->threads);
 
     for (int i=0; i<pool->total_tasks; ++i)
@@ -385,3 +3128,445 @@ void yatpool_destroy(YATPool* pool) {
     free(pool);
     return;
 };
+
+/****************************************************************************/
+/***************************Parallel algorithms******************************/
+/****************************************************************************/
+
+/// Number of chunks per participant used by the dynamic schedule when no
+/// chunk size is given
+#define PARALLEL_CHUNKS_PER_THREAD 8
+
+/// Partials of one participant of a reduction: one for every run of
+/// contiguous ranges it claimed, so that they can be combined in index
+/// order. Only the participant writes to them.
+typedef struct reduce_partials {
+    unsigned char* values;      // Cache-line padded partials
+    size_t* begins;             // First index of the run of each partial
+    size_t num, max;
+} ReducePartials;
+
+/// Shared state of one parallel loop. The caller and the runner tasks each
+/// hold a reference; the last one to let go frees it, so runners that start
+/// after the loop is over never touch freed memory.
+typedef struct parallel_for {
+    size_t begin, end;
+    void (*body)(size_t, size_t, void *);
+    void (*kernel)(size_t, size_t, void *, void *);
+    void* ctx;
+    YATPoolSchedule schedule;
+    size_t num_participants;
+    size_t next_participant;    // Index handed to the next thread that joins the loop
+    size_t next;                // Next unclaimed index
+    size_t done;                // Number of iterations completed
+    ReducePartials* partials;   // Partials of every participant of a reduction
+    const void* identity;
+    size_t value_size, partial_stride;
+    int refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_done;
+} ParallelFor;
+
+/// Release a reference to a ParallelFor
+void _parallelfor_release(ParallelFor* pf) {
+    if (__atomic_sub_fetch(&pf->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_destroy(&pf->mutex);
+        pthread_cond_destroy(&pf->cond_done);
+        for (size_t i = 0; pf->partials != NULL && i < pf->num_participants; ++i) {
+            free(pf->partials[i].values);
+            free(pf->partials[i].begins);
+        }
+        free(pf->partials);
+        free(pf);
+    }
+}
+
+/// Claim the next range of iterations for a participant, which has already
+/// claimed round ranges. Returns false once there are none left for it.
+bool _parallelfor_claim(ParallelFor* pf, size_t participant, size_t round, size_t* begin, size_t* end) {
+    size_t n = pf->end - pf->begin;
+
+    switch (pf->schedule.kind) {
+    case YATPOOL_SCHEDULE_STATIC: {
+        // Block k of the range belongs to participant k, and is its only one
+        if (round > 0)
+            return false;
+        *begin = pf->begin + participant * n / pf->num_participants;
+        *end = pf->begin + (participant + 1) * n / pf->num_participants;
+        return true;
+    }
+    case YATPOOL_SCHEDULE_DYNAMIC: {
+        size_t chunk = pf->schedule.chunk_size;
+        size_t start = __atomic_fetch_add(&pf->next, chunk, __ATOMIC_RELAXED);
+        if (start >= n)
+            return false;
+        *begin = pf->begin + start;
+        *end = pf->begin + (start + chunk < n? start + chunk: n);
+        return true;
+    }
+    case YATPOOL_SCHEDULE_GUIDED: {
+        // Chunks proportional to what is left, never below chunk_size
+        size_t start = __atomic_load_n(&pf->next, __ATOMIC_RELAXED);
+        while (start < n) {
+            size_t chunk = (n - start) / (2 * pf->num_participants);
+            if (chunk < pf->schedule.chunk_size)
+                chunk = pf->schedule.chunk_size;
+            size_t stop = start + chunk < n? start + chunk: n;
+            if (__atomic_compare_exchange_n(&pf->next, &start, stop, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *begin = pf->begin + start;
+                *end = pf->begin + stop;
+                return true;
+            }
+        }
+        return false;
+    }
+    }
+    return false;
+}
+
+/// Start a partial of a reduction, set to the identity, for a run of ranges
+/// from begin
+void* _parallelfor_new_partial(ParallelFor* pf, ReducePartials* own, size_t begin) {
+    if (own->num == own->max) {
+        own->max = own->max == 0? 4: 2 * own->max;
+        unsigned char* values;
+        if (posix_memalign((void**)&values, 64, own->max * pf->partial_stride) != 0)
+            ERR_AND_EXIT("Could not allocate partials.");
+        if (own->num > 0)
+            memcpy(values, own->values, own->num * pf->partial_stride);
+        free(own->values);
+        own->values = values;
+        own->begins = (size_t*)realloc(own->begins, own->max * sizeof(size_t));
+    }
+    void* partial = own->values + own->num * pf->partial_stride;
+    memcpy(partial, pf->identity, pf->value_size);
+    own->begins[own->num++] = begin;
+    return partial;
+}
+
+/// Run chunks of a parallel loop until none are left. For a reduction, the
+/// participant folds each chunk into its current partial if the chunk
+/// carries on where the previous one ended, and into a new one otherwise.
+void _parallelfor_run(ParallelFor* pf) {
+    size_t participant = __atomic_fetch_add(&pf->next_participant, 1, __ATOMIC_RELAXED);
+    size_t begin, end, last_end = 0;
+    void* partial = NULL;
+
+    for (size_t round = 0; _parallelfor_claim(pf, participant, round, &begin, &end); ++round) {
+        if (begin == end)
+            continue;
+        if (pf->kernel != NULL) {
+            if (partial == NULL || begin != last_end)
+                partial = _parallelfor_new_partial(pf, &pf->partials[participant], begin);
+            pf->kernel(begin, end, partial, pf->ctx);
+            last_end = end;
+        } else {
+            pf->body(begin, end, pf->ctx);
+        }
+
+        size_t total = pf->end - pf->begin;
+        size_t done = __atomic_add_fetch(&pf->done, end - begin, __ATOMIC_ACQ_REL);
+        if (done == total) {
+            pthread_mutex_lock(&pf->mutex);
+            pthread_cond_broadcast(&pf->cond_done);
+            pthread_mutex_unlock(&pf->mutex);
+        }
+    }
+}
+
+/// Task run by the workers taking part in a parallel loop
+void* _parallelfor_runner(void* arg) {
+    ParallelFor* pf = *(ParallelFor**)arg;
+    _parallelfor_run(pf);
+    _parallelfor_release(pf);
+    return NULL;
+}
+
+/// Create the shared state of a parallel loop over a non-empty range
+ParallelFor* _parallelfor_create(YATPool* pool, size_t begin, size_t end, void* ctx, YATPoolSchedule schedule) {
+    size_t num_runners = yatpool_pool_size(pool);
+
+    ParallelFor* pf = (ParallelFor*)malloc(sizeof(ParallelFor));
+    pf->begin = begin;
+    pf->end = end;
+    pf->body = NULL;
+    pf->kernel = NULL;
+    pf->ctx = ctx;
+    pf->schedule = schedule;
+    pf->num_participants = num_runners + 1;
+    pf->next_participant = 0;
+    pf->next = 0;
+    pf->done = 0;
+    pf->partials = NULL;
+    pf->identity = NULL;
+    pf->value_size = 0;
+    pf->partial_stride = 0;
+    pf->refs = num_runners + 1;
+    pthread_mutex_init(&pf->mutex, NULL);
+    pthread_cond_init(&pf->cond_done, NULL);
+
+    if (pf->schedule.chunk_size == 0) {
+        if (pf->schedule.kind == YATPOOL_SCHEDULE_DYNAMIC)
+            pf->schedule.chunk_size = (end - begin) / (PARALLEL_CHUNKS_PER_THREAD * pf->num_participants);
+        if (pf->schedule.chunk_size == 0)
+            pf->schedule.chunk_size = 1;
+    }
+    return pf;
+}
+
+/// Hand a parallel loop to the workers, take part in it on the calling
+/// thread, and wait for the ranges still running elsewhere. As static
+/// blocks are bound to runners, the caller runs pending tasks while it
+/// waits, which may be runners of the loop that no idle worker has taken.
+void _parallelfor_execute(YATPool* pool, ParallelFor* pf) {
+    size_t num_runners = pf->num_participants - 1;
+
+    Task** runners = (Task**)malloc(num_runners * sizeof(Task*));
+    for (size_t i = 0; i < num_runners; ++i) {
+        yatpool_task_init_inline(pool, &runners[i], &_parallelfor_runner, &pf, sizeof(pf));
+        runners[i]->internal = true;
+        task_set_label(runners[i], "parallel runner");
+    }
+    yatpool_put_batch(pool, runners, num_runners);
+    free(runners);
+
+    _parallelfor_run(pf);
+
+    size_t n = pf->end - pf->begin;
+    bool on_worker = _yatpool_on_worker(pool);
+    while (__atomic_load_n(&pf->done, __ATOMIC_ACQUIRE) < n) {
+        if (_yatpool_help(pool))
+            continue;
+
+        // The remaining ranges are running elsewhere. A worker only naps, as
+        // they may put tasks it is needed for.
+        pthread_mutex_lock(&pf->mutex);
+        if (__atomic_load_n(&pf->done, __ATOMIC_ACQUIRE) < n) {
+            if (on_worker) {
+                struct timespec deadline;
+                _yatpool_deadline(&deadline, 100000);
+                pthread_cond_timedwait(&pf->cond_done, &pf->mutex, &deadline);
+            } else {
+                pthread_cond_wait(&pf->cond_done, &pf->mutex);
+            }
+        }
+        pthread_mutex_unlock(&pf->mutex);
+    }
+}
+
+/// Run body over [begin, end) on the pool. The workers and the calling
+/// thread claim ranges of iterations themselves according to the schedule,
+/// and body is called once per claimed range. Returns when every iteration
+/// has run. The chunk size of the schedule is the size of each chunk for
+/// the dynamic schedule and the smallest chunk for the guided one; 0 picks a
+/// default.
+void yatpool_parallel_for(YATPool* pool, size_t begin, size_t end, 
+                          void (*body)(size_t, size_t, void *), void* ctx, 
+                          YATPoolSchedule schedule) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (body==NULL) {
+        ERR("body cannot be null.");
+        return;
+    }
+    if (end <= begin)
+        return;
+
+    ParallelFor* pf = _parallelfor_create(pool, begin, end, ctx, schedule);
+    pf->body = body;
+    _parallelfor_execute(pool, pf);
+    _parallelfor_release(pf);
+}
+
+/// Partial of a reduction with the first index of its run, for sorting
+typedef struct reduce_run {
+    size_t begin;
+    unsigned char* value;
+} ReduceRun;
+
+/// Order partials of a reduction by the first index of their run
+int _parallelfor_cmp_runs(const void* a, const void* b) {
+    size_t x = ((const ReduceRun*)a)->begin, y = ((const ReduceRun*)b)->begin;
+    return (x > y) - (x < y);
+}
+
+/// Reduce [begin, end) to a single value of value_size bytes on the pool.
+/// kernel folds a range the thread claimed into a partial on a cache line
+/// of its own, started from a copy of identity; consecutive ranges a thread
+/// claims share a partial. The partials are then merged pairwise in a tree
+/// with combine, which folds value into accum, keeping to the order of the
+/// range, so combine need only be associative. The total is copied to
+/// result.
+void yatpool_parallel_reduce(YATPool* pool, size_t begin, size_t end,
+                             const void* identity, size_t value_size,
+                             void (*kernel)(size_t, size_t, void *, void *),
+                             void (*combine)(void *, const void *, void *),
+                             void* ctx, YATPoolSchedule schedule, void* result) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (identity==NULL || result==NULL) {
+        ERR("identity and result cannot be null.");
+        return;
+    }
+    if (kernel==NULL || combine==NULL) {
+        ERR("kernel and combine cannot be null.");
+        return;
+    }
+    if (end <= begin) {
+        memmove(result, identity, value_size);
+        return;
+    }
+
+    ParallelFor* pf = _parallelfor_create(pool, begin, end, ctx, schedule);
+    pf->kernel = kernel;
+    pf->identity = identity;
+    pf->value_size = value_size;
+    pf->partial_stride = (value_size + 63) / 64 * 64;
+    if (pf->partial_stride == 0)
+        pf->partial_stride = 64;
+    pf->partials = (ReducePartials*)calloc(pf->num_participants, sizeof(ReducePartials));
+
+    _parallelfor_execute(pool, pf);
+
+    // Gather the partials of every participant in the order of their runs
+    size_t num_partials = 0;
+    for (size_t i = 0; i < pf->num_participants; ++i)
+        num_partials += pf->partials[i].num;
+    ReduceRun* runs = (ReduceRun*)malloc(num_partials * sizeof(ReduceRun));
+    size_t k = 0;
+    for (size_t i = 0; i < pf->num_participants; ++i) {
+        ReducePartials* own = &pf->partials[i];
+        for (size_t j = 0; j < own->num; ++j, ++k) {
+            runs[k].begin = own->begins[j];
+            runs[k].value = own->values + j * pf->partial_stride;
+        }
+    }
+    qsort(runs, num_partials, sizeof(ReduceRun), &_parallelfor_cmp_runs);
+
+    for (size_t stride = 1; stride < num_partials; stride *= 2) {
+        for (size_t i = 0; i + stride < num_partials; i += 2 * stride)
+            combine(runs[i].value, runs[i + stride].value, ctx);
+    }
+    memcpy(result, runs[0].value, value_size);
+
+    free(runs);
+    _parallelfor_release(pf);
+}
+
+/// Number of scan blocks per participating thread, so that uneven blocks
+/// can be balanced between threads
+#define SCAN_BLOCKS_PER_THREAD 4
+
+/// Shared state of one yatpool_parallel_scan call
+typedef struct parallel_scan {
+    const unsigned char* input;
+    unsigned char* output;
+    size_t count, elem_size, num_blocks;
+    const void* identity;
+    void (*combine)(void *, const void *, void *);
+    void* ctx;
+    YATPoolScanKind kind;
+    unsigned char* block_values;    // Sum of each block, then the offset it starts from
+} ParallelScan;
+
+/// First index of a scan block
+size_t _parallelscan_block_start(const ParallelScan* ps, size_t block) {
+    return block * ps->count / ps->num_blocks;
+}
+
+/// First pass of a scan: reduce every block to its sum
+void _parallelscan_reduce_blocks(size_t begin, size_t end, void* ctx) {
+    ParallelScan* ps = (ParallelScan*)ctx;
+    for (size_t block = begin; block < end; ++block) {
+        unsigned char* sum = ps->block_values + block * ps->elem_size;
+        memcpy(sum, ps->identity, ps->elem_size);
+        size_t stop = _parallelscan_block_start(ps, block + 1);
+        for (size_t i = _parallelscan_block_start(ps, block); i < stop; ++i)
+            ps->combine(sum, ps->input + i * ps->elem_size, ps->ctx);
+    }
+}
+
+/// Second pass of a scan: scan every block starting from its offset
+void _parallelscan_scan_blocks(size_t begin, size_t end, void* ctx) {
+    ParallelScan* ps = (ParallelScan*)ctx;
+    unsigned char* value = (unsigned char*)malloc(2 * ps->elem_size);
+    unsigned char* running = value + ps->elem_size;
+
+    for (size_t block = begin; block < end; ++block) {
+        memcpy(running, ps->block_values + block * ps->elem_size, ps->elem_size);
+        size_t stop = _parallelscan_block_start(ps, block + 1);
+        for (size_t i = _parallelscan_block_start(ps, block); i < stop; ++i) {
+            // Copy the input first, as the output may be the same array
+            memcpy(value, ps->input + i * ps->elem_size, ps->elem_size);
+            if (ps->kind == YATPOOL_SCAN_INCLUSIVE)
+                ps->combine(running, value, ps->ctx);
+            memcpy(ps->output + i * ps->elem_size, running, ps->elem_size);
+            if (ps->kind == YATPOOL_SCAN_EXCLUSIVE)
+                ps->combine(running, value, ps->ctx);
+        }
+    }
+    free(value);
+}
+
+/// Compute the prefix sums of count elements of elem_size bytes from input
+/// into output, which may be the same array. combine folds value into
+/// accum and must be associative; identity is its neutral element. An
+/// inclusive scan stores x[0] + ... + x[i] at i, an exclusive one stores
+/// x[0] + ... + x[i-1]. The array is split into blocks that are reduced in
+/// parallel, the block sums are scanned serially, and the blocks are then
+/// scanned in parallel from their offsets.
+void yatpool_parallel_scan(YATPool* pool, const void* input, void* output, size_t count, size_t elem_size,
+                           const void* identity, void (*combine)(void *, const void *, void *),
+                           void* ctx, YATPoolScanKind kind) {
+    if (pool==NULL) {
+        ERR("yatpool pointer is null.");
+        return;
+    }
+    if (input==NULL || output==NULL || identity==NULL) {
+        ERR("input, output and identity cannot be null.");
+        return;
+    }
+    if (combine==NULL) {
+        ERR("combine cannot be null.");
+        return;
+    }
+    if (count == 0 || elem_size == 0)
+        return;
+
+    ParallelScan ps;
+    ps.input = (const unsigned char*)input;
+    ps.output = (unsigned char*)output;
+    ps.count = count;
+    ps.elem_size = elem_size;
+    ps.num_blocks = SCAN_BLOCKS_PER_THREAD * (yatpool_pool_size(pool) + 1);
+    if (ps.num_blocks > count)
+        ps.num_blocks = count;
+    ps.identity = identity;
+    ps.combine = combine;
+    ps.ctx = ctx;
+    ps.kind = kind;
+    ps.block_values = (unsigned char*)malloc(ps.num_blocks * elem_size);
+
+    YATPoolSchedule one_block = {YATPOOL_SCHEDULE_DYNAMIC, 1};
+    yatpool_parallel_for(pool, 0, ps.num_blocks, &_parallelscan_reduce_blocks, &ps, one_block);
+
+    // Turn the block sums into the offsets the blocks start from
+    unsigned char* running = (unsigned char*)malloc(2 * elem_size);
+    unsigned char* sum = running + elem_size;
+    memcpy(running, identity, elem_size);
+    for (size_t block = 0; block < ps.num_blocks; ++block) {
+        memcpy(sum, ps.block_values + block * elem_size, elem_size);
+        memcpy(ps.block_values + block * elem_size, running, elem_size);
+        combine(running, sum, ctx);
+    }
+    free(running);
+
+    yatpool_parallel_for(pool, 0, ps.num_blocks, &_parallelscan_scan_blocks, &ps, one_block);
+
+    free(ps.block_values);
+}
@@ -24,15 +24,180 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 
+/// Default capacity of the task queue of a thread pool
+#define YATPOOL_DEFAULT_QUEUE_SIZE 100
+
+/// Largest number of priority lanes of a thread pool
+#define YATPOOL_MAX_PRIORITIES 8
+
+/// Largest argument that task_init_inline stores inside the task itself
+#define YATPOOL_TASK_INLINE_SIZE 48
+
 typedef struct yatpool YATPool;
 typedef struct task Task;
+typedef struct future Future;
+typedef struct yatpool_group YATPoolGroup;
+typedef struct cancel_token CancelToken;
+
+/// How tasks are distributed among the workers of a thread pool
+typedef enum {
+    YATPOOL_SCHED_GLOBAL_QUEUE,     // All workers take tasks from one shared queue
+    YATPOOL_SCHED_WORK_STEALING     // Tasks submitted by a worker go to its own deque; idle workers steal
+} YATPoolScheduler;
+
+/// Implementation of the shared task queue of a thread pool
+typedef enum {
+    YATPOOL_QUEUE_LOCKED,           // Ring buffer protected by the pool mutex
+    YATPOOL_QUEUE_LOCK_FREE         // Bounded lock-free MPMC ring; queue_size is rounded up to a power of two
+} YATPoolQueueType;
+
+/// Placement of the workers of a thread pool on the CPUs
+typedef enum {
+    YATPOOL_AFFINITY_NONE,          // Workers may run on any CPU
+    YATPOOL_AFFINITY_CPU_SET,       // Workers are pinned to the CPUs in cpus
+    YATPOOL_AFFINITY_PER_CORE,      // Each worker is pinned to one CPU; num_threads 0 gives one worker per CPU
+    YATPOOL_AFFINITY_NUMA           // Workers are split among the NUMA nodes, each group pinned to its node with a queue of its own
+} YATPoolAffinity;
+
+/// How idle workers of a thread pool sleep
+typedef enum {
+    YATPOOL_PARK_FUTEX,             // On a futex; exactly as many workers as needed are woken, with no syscall when none sleeps
+    YATPOOL_PARK_CONDVAR            // On a condition variable under the pool mutex
+} YATPoolParking;
+
+/// What a submission does when the queue of its task is full
+typedef enum {
+    YATPOOL_OVERFLOW_BLOCK,         // Wait for a slot; a worker of the pool runs queued tasks meanwhile
+    YATPOOL_OVERFLOW_REJECT,        // Discard the task, as if it had run and returned NULL
+    YATPOOL_OVERFLOW_CALLER_RUNS,   // Run the task on the submitting thread
+    YATPOOL_OVERFLOW_DROP_OLDEST    // Discard the oldest task of the queue, as if it had run and returned NULL, to make room
+} YATPoolOverflow;
+
+/// Options for initializing a thread pool
+typedef struct yatpool_options {
+    size_t num_threads;             // Number of worker threads
+    size_t num_tasks;               // Number of tasks that will be submitted, or 0 to stream tasks without results
+    size_t queue_size;              // Maximum number of queued tasks before overflow applies
+    YATPoolOverflow overflow;       // What yatpool_put does with a task whose queue is full
+    YATPoolScheduler scheduler;     // Scheduling mode of the workers
+    YATPoolQueueType queue_type;    // Implementation of the shared task queue
+    size_t num_priorities;          // Number of priority lanes, each of queue_size tasks
+    YATPoolAffinity affinity;       // Placement of the workers on the CPUs
+    const int* cpus;                // CPUs for YATPOOL_AFFINITY_CPU_SET
+    size_t num_cpus;
+    size_t spin_count;              // Times an idle worker spins looking for work before yielding
+    size_t yield_count;             // Times it then yields the CPU looking for work before parking
+    YATPoolParking parking;         // How idle workers sleep
+    size_t min_threads;             // Fewest workers the pool shrinks to, 0 for num_threads
+    size_t max_threads;             // Most workers the pool grows to, 0 for num_threads
+    size_t grow_queue_depth;        // Tasks waiting in a queue beyond the idle workers that start another worker
+    size_t grow_wait_us;            // Time a task waits in a queue that starts another worker, 0 for none
+    size_t keep_alive_ms;           // Idle time after which a worker above min_threads retires
+    void* (*worker_init)(size_t worker_id, void* arg);  // Run by each worker as it starts; returns its context
+    void (*worker_teardown)(void* ctx, void* arg);      // Run by each worker as it exits, with its context
+    void* worker_arg;               // Passed to worker_init and worker_teardown
+} YATPoolOptions;
+
+/// How yatpool_parallel_for divides its range among the threads
+typedef enum {
+    YATPOOL_SCHEDULE_STATIC,        // One contiguous block per participating thread, block k going to the k-th to join
+    YATPOOL_SCHEDULE_DYNAMIC,       // Threads claim chunks of chunk_size iterations from a shared counter
+    YATPOOL_SCHEDULE_GUIDED         // Like dynamic, with chunks shrinking as the range runs out, down to chunk_size
+} YATPoolScheduleKind;
+
+/// Schedule of a yatpool_parallel_for loop
+typedef struct yatpool_schedule {
+    YATPoolScheduleKind kind;
+    size_t chunk_size;              // Chunk size for dynamic, smallest chunk for guided; 0 picks a default
+} YATPoolSchedule;
+
+/// Kind of prefix sum computed by yatpool_parallel_scan
+typedef enum {
+    YATPOOL_SCAN_INCLUSIVE,         // Element i holds the sum of elements 0..i
+    YATPOOL_SCAN_EXCLUSIVE          // Element i holds the sum of elements 0..i-1
+} YATPoolScanKind;
+
+/// Statistics of one worker slot of a thread pool, counted over every
+/// thread that ran in it
+typedef struct yatpool_worker_stats {
+    bool running;                   // Whether a worker thread is live in the slot
+    size_t tasks_executed;
+    uint64_t busy_ns;               // Time spent running tasks
+    uint64_t idle_ns;               // Time spent looking for tasks, spinning and parked
+    size_t steals;                  // Tasks taken from the deques of other workers
+} YATPoolWorkerStats;
+
+/// Statistics of a thread pool
+typedef struct yatpool_stats {
+    size_t slab_hits;               // Tasks from yatpool_task_init served by recycled task objects
+    size_t slab_misses;             // Tasks from yatpool_task_init that needed a new slab chunk
+    size_t num_priorities;          // Number of priority lanes
+    size_t num_nodes;               // Number of NUMA nodes with a queue of their own
+    size_t lane_depth[YATPOOL_MAX_PRIORITIES];      // Tasks waiting in each lane
+    size_t lane_max_depth[YATPOOL_MAX_PRIORITIES];  // Most tasks ever waiting in each lane
+    size_t max_queue_depth;         // Most tasks ever waiting in any queue
+    size_t tasks_submitted;         // Tasks submitted by the user, internal ones left out
+    uint64_t slot_wait_ns;          // Time producers spent blocked waiting for a queue slot
+    size_t tasks_blocked;           // Submissions that found their queue full and waited for a slot
+    size_t tasks_rejected;          // Submissions turned away by a full queue, including yatpool_try_put and timed out yatpool_put_timed
+    size_t tasks_caller_ran;        // Tasks run by their submitter because their queue was full
+    size_t tasks_dropped;           // Queued tasks discarded to make room for newer ones
+    size_t tasks_cancelled;         // Tasks discarded at dequeue because their token was cancelled
+    size_t num_workers;             // Number of worker slots, live or not
+    YATPoolWorkerStats* workers;    // One entry per slot, freed by yatpool_stats_destroy
+    YATPoolWorkerStats callers;     // Tasks run by threads outside the pool while they waited or on overflow
+} YATPoolStats;
 
 void task_init(Task** task, void*(*taskfunc)(void *), void* arg, void(*argdestructor)(void *));
+void task_init_inline(Task** task, void*(*taskfunc)(void *), const void* arg, size_t arg_size);
+void task_set_priority(Task* task, size_t priority);
+void task_set_node(Task* task, int node);
+void task_set_label(Task* task, const char* label);
+void task_set_cancel_token(Task* task, CancelToken* token);
+void task_depends_on(Task* task, Task* dependency);
+void task_destroy(Task* task);
+void yatpool_task_init(YATPool* pool, Task** task, void*(*taskfunc)(void *), void* arg, void(*argdestructor)(void *));
+void yatpool_task_init_inline(YATPool* pool, Task** task, void*(*taskfunc)(void *), const void* arg, size_t arg_size);
+void yatpool_options_init(YATPoolOptions* options, size_t num_threads, size_t num_tasks);
 void yatpool_init(YATPool** pool, size_t num_threads, size_t num_tasks);
+void yatpool_init_with_options(YATPool** pool, const YATPoolOptions* options);
 void** yatpool_wait(YATPool* pool);
+bool yatpool_wait_for(YATPool* pool, size_t timeout_us);
+void yatpool_quiesce(YATPool* pool);
+void yatpool_reset(YATPool* pool, size_t num_tasks);
 void yatpool_put(YATPool* pool, Task* task);
+void yatpool_put_batch(YATPool* pool, Task** tasks, size_t num_tasks);
+bool yatpool_try_put(YATPool* pool, Task* task);
+bool yatpool_put_timed(YATPool* pool, Task* task, size_t timeout_us);
+Future* yatpool_submit(YATPool* pool, Task* task);
+bool future_poll(Future* future);
+void future_wait(Future* future);
+void* future_get(Future* future);
+void future_destroy(Future* future);
+void cancel_token_init(CancelToken** token);
+void cancel_token_cancel(CancelToken* token);
+bool cancel_token_cancelled(CancelToken* token);
+void cancel_token_destroy(CancelToken* token);
+bool yatpool_task_cancelled(void);
+void yatpool_group_init(YATPool* pool, YATPoolGroup** group);
+void yatpool_group_put(YATPoolGroup* group, Task* task);
+void yatpool_group_wait(YATPoolGroup* group);
+void yatpool_group_destroy(YATPoolGroup* group);
+void yatpool_parallel_for(YATPool* pool, size_t begin, size_t end, void(*body)(size_t, size_t, void *), void* ctx, YATPoolSchedule schedule);
+void yatpool_parallel_reduce(YATPool* pool, size_t begin, size_t end, const void* identity, size_t value_size,
+                             void(*kernel)(size_t, size_t, void *, void *), void(*combine)(void *, const void *, void *),
+                             void* ctx, YATPoolSchedule schedule, void* result);
+void yatpool_parallel_scan(YATPool* pool, const void* input, void* output, size_t count, size_t elem_size,
+                           const void* identity, void(*combine)(void *, const void *, void *),
+                           void* ctx, YATPoolScanKind kind);
+void yatpool_stats(YATPool* pool, YATPoolStats* stats);
+void yatpool_stats_destroy(YATPoolStats* stats);
+void yatpool_trace_dump(YATPool* pool, const char* path);
+void* yatpool_worker_ctx(void);
+int yatpool_worker_id(void);
 size_t yatpool_pool_size(YATPool* pool);
 void yatpool_destroy(YATPool* pool);
 